@@ -1,26 +1,132 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "tree.h"
 
+// Readers of a concurrent tree bump a counter in one of these stripes
+// so that they don't all fight over the same cache line.
+#define TREE_READER_STRIPES 64
+#define TREE_CACHE_LINE 64
+
+// Replaced nodes are held until this many have built up and are then
+// freed together, so the writer only waits for readers once per batch.
+#define TREE_RETIRE_BATCH 1024
+
+typedef struct reader_stripe {
+    long count[2];
+    char pad[TREE_CACHE_LINE - 2 * sizeof(long)];
+} reader_stripe;
+
+// The writer flips phase to send new readers to the other counter,
+// then waits for the old counter to drain.  Doing that for both
+// counters is a grace period: no reader that started before it can
+// still be holding a node that was unlinked before it.
+struct tree_sync {
+    reader_stripe stripes[TREE_READER_STRIPES];
+    int phase;
+    tree_node **retired;
+    size_t num_retired;
+    size_t retired_capacity;
+};
+
 #define HERE fprintf(stderr, "YOU NEED TO IMPLEMENT THIS!\n");
 
+static int int64_cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int string_cmp(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+// The first 8 bytes of a string, first byte most significant and zero
+// filled past the end of the string.
+static uint64_t string_prefix(const char *s)
+{
+    uint64_t prefix = 0;
+    int i = 0;
+    for (; i < 8 && s[i] != '\0'; i++) {
+        prefix = (prefix << 8) | (unsigned char)s[i];
+    }
+    // Shifting a 64 bit value by 64 is undefined, so "" is its own case.
+    return i == 0 ? 0 : prefix << (8 * (8 - i));
+}
+
+// The key_cache a node holding key gets, which is also what lookups
+// compare against.
+static uint64_t cache_key(const tree *t, const void *key)
+{
+    switch (t->key_kind) {
+    case TREE_KEY_INT64:
+        return (uint64_t)*(const int64_t *)key;
+    case TREE_KEY_STRING:
+        return string_prefix((const char *)key);
+    default:
+        return 0;
+    }
+}
+
+// Compares a key (with its key_cache already worked out) against a
+// node.  Same sign convention as comparison_fn.
+static inline int compare_key(const tree *t, const void *key, uint64_t cache, const tree_node *n)
+{
+    switch (t->key_kind) {
+    case TREE_KEY_INT64:
+        return ((int64_t)cache > (int64_t)n->key_cache) - ((int64_t)cache < (int64_t)n->key_cache);
+    case TREE_KEY_STRING:
+        if (cache != n->key_cache) {
+            return cache < n->key_cache ? -1 : 1;
+        }
+        // Equal prefixes that end in a zero byte means both strings
+        // ended inside the prefix.
+        if ((cache & 0xff) == 0) {
+            return 0;
+        }
+        return strcmp((const char *)key + 8, (const char *)n->key + 8);
+    default:
+        return t->comparison_fn(key, n->key);
+    }
+}
+
 // A useful helper function for contains/find/insert.
 // This returns the pointer to the node that matches the
-// key or NULL if nothing matches.
-tree_node *find_node(tree_node *t, const void *key, int (*comparison_fn)(const void *, const void *))
+// key or NULL if nothing matches.  Each key kind gets its own loop so
+// the comparison is inlined rather than switched on at every level.
+tree_node *find_node(const tree *t, tree_node *n, const void *key)
 {
-    if (t == NULL) {
+    uint64_t cache = cache_key(t, key);
+    switch (t->key_kind) {
+    case TREE_KEY_INT64:
+        while (n != NULL && (int64_t)n->key_cache != (int64_t)cache) {
+            n = (int64_t)cache < (int64_t)n->key_cache ? n->left : n->right;
+        }
+        return n;
+    case TREE_KEY_STRING:
+        while (n != NULL) {
+            int cmp = compare_key(t, key, cache, n);
+            if (cmp == 0) {
+                return n;
+            }
+            n = cmp < 0 ? n->left : n->right;
+        }
+        return NULL;
+    default:
+        while (n != NULL) {
+            int cmp = t->comparison_fn(key, n->key);
+            if (cmp == 0) {
+                return n; //This means that we have found the node 
+            }
+            n = cmp < 0 ? n->left : n->right; //go to the left or right subtree 
+        }
         return NULL;
-    }
-    int cmp = comparison_fn(key, t->key); 
-
-    if (cmp == 0){
-        return t; //This means that we have found the node 
-    } else if (cmp < 0){
-        return find_node(t->left,key,comparison_fn); //Here we initiate the recursive call on find node so that we can go to the left subtree 
-    } else {
-        return find_node(t->right, key, comparison_fn); //Here, we go to the right subtree 
     }
 }
 
@@ -33,9 +139,333 @@ tree *new_tree(int (*comparison_fn)(const void *, const void *))
     }
     t->root = NULL;
     t-> comparison_fn = comparison_fn; 
+    t->key_kind = TREE_KEY_GENERIC;
+    t->sync = NULL;
+    t->lazy_delete = false;
+    t->tombstones = NULL;
+    t->num_tombstones = 0;
+    t->tombstone_capacity = 0;
+    t->order_stats = false;
+    t->index = NULL;
     return t;
 }
 
+// Each thread picks a stripe the first time it reads and keeps it.
+static int reader_stripe_index(void)
+{
+    static int next_stripe = 0;
+    static _Thread_local int stripe = -1;
+    if (stripe < 0) {
+        stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % TREE_READER_STRIPES;
+    }
+    return stripe;
+}
+
+// Starts a read-side critical section.  The returned token is handed
+// back to read_unlock.  Plain trees have nothing to track.
+static long *read_lock(tree *t)
+{
+    if (t->sync == NULL) {
+        return NULL;
+    }
+    reader_stripe *r = &t->sync->stripes[reader_stripe_index()];
+    long *count = &r->count[__atomic_load_n(&t->sync->phase, __ATOMIC_SEQ_CST) & 1];
+    __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+    return count;
+}
+
+static void read_unlock(long *count)
+{
+    if (count != NULL) {
+        __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// The root as seen by a reader.  Both sides are seq_cst, not just
+// acquire/release: the reader bumps its counter and then loads the root,
+// the writer stores the root and then reads the counters, and only a
+// single total order guarantees that one of them sees the other.  With
+// acquire/release a reader could still pick up the old root after the
+// writer has found its counter empty.
+static tree_node *read_root(tree *t)
+{
+    return __atomic_load_n(&t->root, __ATOMIC_SEQ_CST);
+}
+
+static void publish_root(tree *t, tree_node *root)
+{
+    __atomic_store_n(&t->root, root, __ATOMIC_SEQ_CST);
+}
+
+static void wait_for_readers(struct tree_sync *s, int idx)
+{
+    for (;;) {
+        long total = 0;
+        for (int i = 0; i < TREE_READER_STRIPES; i++) {
+            total += __atomic_load_n(&s->stripes[i].count[idx], __ATOMIC_SEQ_CST);
+        }
+        if (total == 0) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+// Waits until every reader that might have seen a retired node is done
+// and then frees the retired nodes.
+static void reclaim_retired(struct tree_sync *s)
+{
+    for (int flip = 0; flip < 2; flip++) {
+        int old = __atomic_fetch_add(&s->phase, 1, __ATOMIC_SEQ_CST) & 1;
+        wait_for_readers(s, old);
+    }
+    for (size_t i = 0; i < s->num_retired; i++) {
+        free(s->retired[i]);
+    }
+    s->num_retired = 0;
+}
+
+// Queues a node that is no longer reachable from the published root.
+static void retire_node(struct tree_sync *s, tree_node *n)
+{
+    if (s->num_retired == s->retired_capacity) {
+        size_t capacity = s->retired_capacity ? s->retired_capacity * 2 : TREE_RETIRE_BATCH;
+        tree_node **retired = (tree_node **)realloc(s->retired, capacity * sizeof(tree_node *));
+        if (retired == NULL) {
+            // Out of memory: fall back to waiting out the readers now.
+            reclaim_retired(s);
+        } else {
+            s->retired = retired;
+            s->retired_capacity = capacity;
+        }
+    }
+    if (s->num_retired == s->retired_capacity) {
+        // Still no room, and nobody can see n once reclaim has finished.
+        reclaim_retired(s);
+        free(n);
+        return;
+    }
+    s->retired[s->num_retired++] = n;
+}
+
+// Gives a freshly made, empty tree what it needs to be concurrent.
+static tree *make_concurrent(tree *t)
+{
+    if (t == NULL) {
+        return NULL;
+    }
+    size_t size = (sizeof(struct tree_sync) + TREE_CACHE_LINE - 1) / TREE_CACHE_LINE * TREE_CACHE_LINE;
+    struct tree_sync *s = (struct tree_sync *)aligned_alloc(TREE_CACHE_LINE, size);
+    if (s == NULL) {
+        free(t);
+        return NULL;
+    }
+    memset(s, 0, size);
+    t->sync = s;
+    return t;
+}
+
+tree *new_concurrent_tree(int (*comparison_fn)(const void *, const void *))
+{
+    return make_concurrent(new_tree(comparison_fn));
+}
+
+tree *new_tree_for_keys(tree_key_kind kind, bool concurrent)
+{
+    tree *t;
+    switch (kind) {
+    case TREE_KEY_INT64:
+        t = new_tree(int64_cmp);
+        break;
+    case TREE_KEY_STRING:
+        t = new_tree(string_cmp);
+        break;
+    default:
+        // A generic tree needs a comparison function.
+        return NULL;
+    }
+    if (t == NULL) {
+        return NULL;
+    }
+    t->key_kind = kind;
+    return concurrent ? make_concurrent(t) : t;
+}
+
+tree *new_int64_tree(void)
+{
+    return new_tree_for_keys(TREE_KEY_INT64, false);
+}
+
+tree *new_string_tree(void)
+{
+    return new_tree_for_keys(TREE_KEY_STRING, false);
+}
+
+// Grow the hash index before it gets more than half full.
+#define INDEX_MIN_CAPACITY 16
+
+// One slot of the hash index.  node is NULL for an empty slot.  The
+// hash is kept so probing and growing never have to rehash keys.
+typedef struct index_slot {
+    tree_node *node;
+    uint64_t hash;
+} index_slot;
+
+// Linear probing, with capacity always a power of two.
+struct tree_hash_index {
+    uint64_t (*hash_fn)(const void *key);
+    index_slot *slots;
+    size_t capacity;
+    size_t used;
+};
+
+// The splitmix64 finalizer.
+static uint64_t int64_hash(const void *key)
+{
+    uint64_t x = *(const uint64_t *)key;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// 64 bit FNV-1a.
+static uint64_t string_hash(const void *key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+        h = (h ^ *c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void index_place(index_slot *slots, size_t capacity, tree_node *n, uint64_t hash)
+{
+    size_t i = hash & (capacity - 1);
+    while (slots[i].node != NULL) {
+        i = (i + 1) & (capacity - 1);
+    }
+    slots[i].node = n;
+    slots[i].hash = hash;
+}
+
+static bool index_resize(struct tree_hash_index *ix, size_t capacity)
+{
+    index_slot *slots = (index_slot *)calloc(capacity, sizeof(index_slot));
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < ix->capacity; i++) {
+        if (ix->slots[i].node != NULL) {
+            index_place(slots, capacity, ix->slots[i].node, ix->slots[i].hash);
+        }
+    }
+    free(ix->slots);
+    ix->slots = slots;
+    ix->capacity = capacity;
+    return true;
+}
+
+static bool index_add(struct tree_hash_index *ix, tree_node *n)
+{
+    if ((ix->used + 1) * 2 > ix->capacity && !index_resize(ix, ix->capacity * 2)) {
+        return false;
+    }
+    index_place(ix->slots, ix->capacity, n, ix->hash_fn(n->key));
+    ix->used++;
+    return true;
+}
+
+static tree_node *index_find(const tree *t, const void *key)
+{
+    const struct tree_hash_index *ix = t->index;
+    uint64_t hash = ix->hash_fn(key);
+    uint64_t cache = cache_key(t, key);
+    size_t mask = ix->capacity - 1;
+    for (size_t i = hash & mask; ix->slots[i].node != NULL; i = (i + 1) & mask) {
+        if (ix->slots[i].hash == hash && compare_key(t, key, cache, ix->slots[i].node) == 0) {
+            return ix->slots[i].node;
+        }
+    }
+    return NULL;
+}
+
+// Takes n out of the index, shifting later entries of the same probe
+// run back so that no lookup stops early at the hole.
+static void index_remove(struct tree_hash_index *ix, tree_node *n)
+{
+    size_t mask = ix->capacity - 1;
+    size_t i = ix->hash_fn(n->key) & mask;
+    while (ix->slots[i].node != n) {
+        if (ix->slots[i].node == NULL) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    for (size_t j = (i + 1) & mask; ix->slots[j].node != NULL; j = (j + 1) & mask) {
+        // Where the entry at j would like to be.  It can fill the hole
+        // at i unless its home lies cyclically in (i, j].
+        size_t home = ix->slots[j].hash & mask;
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            ix->slots[i] = ix->slots[j];
+            i = j;
+        }
+    }
+    ix->slots[i].node = NULL;
+    ix->used--;
+}
+
+static void free_index(tree *t)
+{
+    if (t->index != NULL) {
+        free(t->index->slots);
+        free(t->index);
+        t->index = NULL;
+    }
+}
+
+static bool index_subtree(struct tree_hash_index *ix, tree_node *n)
+{
+    if (n == NULL) {
+        return true;
+    }
+    return index_add(ix, n) && index_subtree(ix, n->left) && index_subtree(ix, n->right);
+}
+
+bool tree_enable_hash_index(tree *t, uint64_t (*hash_fn)(const void *key))
+{
+    if (t->sync != NULL) {
+        return false;
+    }
+    if (hash_fn == NULL) {
+        switch (t->key_kind) {
+        case TREE_KEY_INT64:
+            hash_fn = int64_hash;
+            break;
+        case TREE_KEY_STRING:
+            hash_fn = string_hash;
+            break;
+        default:
+            return false;
+        }
+    }
+    free_index(t);
+    struct tree_hash_index *ix = (struct tree_hash_index *)malloc(sizeof(struct tree_hash_index));
+    if (ix == NULL) {
+        return false;
+    }
+    ix->hash_fn = hash_fn;
+    ix->capacity = INDEX_MIN_CAPACITY;
+    ix->used = 0;
+    ix->slots = (index_slot *)calloc(ix->capacity, sizeof(index_slot));
+    t->index = ix;
+    if (ix->slots == NULL || !index_subtree(ix, t->root)) {
+        free_index(t);
+        return false;
+    }
+    return true;
+}
+
 // Frees the the nodes, but does not free the keys
 // or data (deliberately so).
 void free_node(tree_node *t)
@@ -56,37 +486,286 @@ void free_tree(tree *t)
         return; 
     }
     free_node(t->root); //Here, we call the free node function on the root so we can free the root node 
+    if (t->sync != NULL) {
+        for (size_t i = 0; i < t->sync->num_retired; i++) {
+            free(t->sync->retired[i]);
+        }
+        free(t->sync->retired);
+        free(t->sync);
+    }
+    free(t->tombstones);
+    free_index(t);
     free(t); //This frees the tree structure 
 }
 
 // Returns true if the key (comparison == 0) is in the tree
 bool contains(tree *t, const void *key)
 {
-    return find_node(t->root, key, t->comparison_fn) != NULL; 
+    long *reading = read_lock(t);
+    tree_node *node = t->index != NULL ? index_find(t, key) : find_node(t, read_root(t), key);
+    bool found = node != NULL && !node->deleted;
+    read_unlock(reading);
+    return found;
 }
 
 // Returns the data or NULL if the data is not in the tree.
 void *find(tree *t, const void *key)
 {
-    tree_node *node = find_node(t->root,key,t->comparison_fn);
-    if (node == NULL) { //checking if the node is null 
-        return NULL; 
+    long *reading = read_lock(t);
+    tree_node *node = t->index != NULL ? index_find(t, key) : find_node(t, read_root(t), key);
+    void *data = NULL;
+    if (node != NULL && !node->deleted) { //checking if the node is null or erased 
+        data = node->data; //otherwise we just return the data within node 
+    }
+    read_unlock(reading);
+    return data;
+}
+
+static tree_node *new_node(void *key, uint64_t cache, void *data)
+{
+    tree_node *n = (tree_node *)malloc(sizeof(tree_node));
+    if (n == NULL) {
+        return NULL;
+    }
+    n->key = key;
+    n->data = data;
+    n->left = NULL;
+    n->right = NULL;
+    n->key_cache = cache;
+    n->deleted = false;
+    n->tombstone_slot = 0;
+    n->size = 1;
+    return n;
+}
+
+// Remembers the key of a node that has just been marked deleted so
+// tree_compact can find it, and where it went.
+static bool queue_tombstone(tree *t, tree_node *n)
+{
+    if (t->num_tombstones == UINT_MAX) {
+        return false;
+    }
+    if (t->num_tombstones == t->tombstone_capacity) {
+        size_t capacity = t->tombstone_capacity ? t->tombstone_capacity * 2 : 64;
+        void **keys = (void **)realloc(t->tombstones, capacity * sizeof(void *));
+        if (keys == NULL) {
+            return false;
+        }
+        t->tombstones = keys;
+        t->tombstone_capacity = capacity;
     }
-    return node->data; //otherwise we just return the data within node 
+    n->tombstone_slot = (unsigned int)t->num_tombstones;
+    t->tombstones[t->num_tombstones++] = n->key;
+    return true;
+}
+
+// Called as a deleted node comes back.  Its queued key is cleared so
+// that tree_compact never looks at it again: the caller may free that
+// key as soon as insert has handed the node a new one.
+static void forget_tombstone(tree *t, const tree_node *n)
+{
+    if (n->tombstone_slot < t->num_tombstones && t->tombstones[n->tombstone_slot] == n->key) {
+        t->tombstones[n->tombstone_slot] = NULL;
+    }
+}
+
+// The nodes visited on the way down to a key, root first.
+typedef struct node_path {
+    tree_node **nodes;
+    size_t len;
+    size_t capacity;
+} node_path;
+
+static bool path_push(node_path *p, tree_node *n)
+{
+    if (p->len == p->capacity) {
+        size_t capacity = p->capacity ? p->capacity * 2 : 64;
+        tree_node **nodes = (tree_node **)realloc(p->nodes, capacity * sizeof(tree_node *));
+        if (nodes == NULL) {
+            return false;
+        }
+        p->nodes = nodes;
+        p->capacity = capacity;
+    }
+    p->nodes[p->len++] = n;
+    return true;
+}
+
+// Records the path from n down to key.  Returns the node holding key,
+// which is then the last one in the path, or NULL if key is not there.
+// *ok is cleared if the path could not be recorded.
+static tree_node *record_path(const tree *t, tree_node *n, const void *key, uint64_t cache,
+                              node_path *p, bool *ok)
+{
+    while (n != NULL) {
+        if (!path_push(p, n)) {
+            *ok = false;
+            return NULL;
+        }
+        int cmp = compare_key(t, key, cache, n);
+        if (cmp == 0) {
+            return n;
+        }
+        n = cmp < 0 ? n->left : n->right;
+    }
+    return NULL;
+}
+
+// Copies p->nodes[0..count) and links each copy to the copy after it,
+// so copies[0] heads a private version of that path.  The last copy's
+// children are still the originals.
+static tree_node **copy_path(const node_path *p, size_t count)
+{
+    tree_node **copies = (tree_node **)malloc((count ? count : 1) * sizeof(tree_node *));
+    if (copies == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        copies[i] = (tree_node *)malloc(sizeof(tree_node));
+        if (copies[i] == NULL) {
+            while (i-- > 0) {
+                free(copies[i]);
+            }
+            free(copies);
+            return NULL;
+        }
+        *copies[i] = *p->nodes[i];
+    }
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (copies[i]->left == p->nodes[i + 1]) {
+            copies[i]->left = copies[i + 1];
+        } else {
+            copies[i]->right = copies[i + 1];
+        }
+    }
+    return copies;
+}
+
+// Points whichever child of parent was old at replacement.
+static void replace_child(tree_node *parent, tree_node *old, tree_node *replacement)
+{
+    if (parent->left == old) {
+        parent->left = replacement;
+    } else {
+        parent->right = replacement;
+    }
+}
+
+// Publishes a new root for a concurrent tree and retires the nodes of
+// p that it replaced.
+static void swap_root(tree *t, tree_node *root, const node_path *p, size_t count)
+{
+    publish_root(t, root);
+    for (size_t i = 0; i < count; i++) {
+        retire_node(t->sync, p->nodes[i]);
+    }
+    if (t->sync->num_retired >= TREE_RETIRE_BATCH) {
+        reclaim_retired(t->sync);
+    }
+}
+
+// 1 for a node that counts towards sizes, 0 for a tombstone.
+static size_t live(const tree_node *n)
+{
+    return n->deleted ? 0 : 1;
+}
+
+static size_t size_of(const tree_node *n)
+{
+    return n == NULL ? 0 : n->size;
+}
+
+// Adds delta to the size of every node on the path from the root to
+// key, stopping short of the key's own node unless include_node is set.
+static void adjust_sizes(tree *t, const void *key, uint64_t cache, long delta, bool include_node)
+{
+    tree_node *n = t->root;
+    while (n != NULL) {
+        int cmp = compare_key(t, key, cache, n);
+        if (cmp == 0 && !include_node) {
+            return;
+        }
+        n->size += delta;
+        if (cmp == 0) {
+            return;
+        }
+        n = cmp < 0 ? n->left : n->right;
+    }
+}
+
+// Insert for concurrent trees.  Every node on the path to the key is
+// copied, the new path is published with a single store to the root,
+// and the old path is retired.  Readers holding the old root keep a
+// complete, unchanged tree.
+static void insert_concurrent(tree *t, void *key, uint64_t cache, void *data)
+{
+    node_path p = {NULL, 0, 0};
+    bool ok = true;
+    tree_node *found = record_path(t, t->root, key, cache, &p, &ok);
+    tree_node *leaf = NULL;
+    tree_node **copies = NULL;
+    if (ok && found == NULL) {
+        leaf = new_node(key, cache, data);
+    }
+    if (ok && (found != NULL || leaf != NULL)) {
+        copies = copy_path(&p, p.len);
+    }
+    if (copies == NULL) {
+        free(leaf);
+        free(p.nodes);
+        return;
+    }
+    // A new key, or an erased one coming back, adds one to the size
+    // of everything on the path.
+    bool added = found == NULL || found->deleted;
+    if (found != NULL) {
+        tree_node *copy = copies[p.len - 1];
+        copy->data = data;
+        if (copy->deleted) {
+            forget_tombstone(t, copy);
+            copy->key = key;
+            copy->deleted = false;
+        }
+    } else if (p.len == 0) {
+        copies[0] = leaf;
+    } else if (compare_key(t, key, cache, copies[p.len - 1]) < 0) {
+        copies[p.len - 1]->left = leaf;
+    } else {
+        copies[p.len - 1]->right = leaf;
+    }
+    for (size_t i = 0; t->order_stats && added && i < p.len; i++) {
+        copies[i]->size++;
+    }
+    swap_root(t, copies[0], &p, p.len);
+    free(copies);
+    free(p.nodes);
 }
 
 // Inserts the element into the tree
 void insert(tree *t, void *key, void *data)
 {
+    uint64_t cache = cache_key(t, key);
+    if (t->sync != NULL) {
+        insert_concurrent(t, key, cache, data);
+        return;
+    }
     tree_node *parent = NULL; //initialize the tree's parent node to be null 
     tree_node *current = t -> root; //but we make the current node our "root"
     int cmp; 
 
     while (current != NULL){ //when current is not null then we initialize cmp to take over comparisons 
-        cmp = t->comparison_fn(key,current->key); 
+        cmp = compare_key(t, key, cache, current); 
 
         if (cmp == 0){ //as long as cmp is 0 then we just return the data 
             current->data = data; 
+            if (current->deleted) { //an erased key coming back is a fresh entry 
+                forget_tombstone(t, current);
+                current->key = key;
+                current->deleted = false;
+                if (t->order_stats) {
+                    adjust_sizes(t, key, cache, 1, true);
+                }
+            }
             return; 
         }
         parent = current; //we make the parent node to be the current one 
@@ -97,20 +776,25 @@ void insert(tree *t, void *key, void *data)
         }
     }
 
-    tree_node *new_node = (tree_node *)malloc(sizeof(tree_node)); 
-    new_node->key = key; 
-    new_node->data = data; 
-    new_node->left = NULL; 
-    new_node->right = NULL; 
+    tree_node *leaf = new_node(key, cache, data);
+    if (leaf == NULL) {
+        return;
+    }
 
     if (parent == NULL){ //here, we check if the parent is null then the root is just the new node 
-        t->root = new_node; 
+        t->root = leaf; 
     } else if (cmp<0){ //designing the tree structure once again 
-        parent ->left = new_node; 
+        parent ->left = leaf; 
     } else {
-        parent->right = new_node;
+        parent->right = leaf;
+    }
+    if (t->order_stats) {
+        adjust_sizes(t, key, cache, 1, false);
+    }
+    if (t->index != NULL && !index_add(t->index, leaf)) {
+        // A partial index would hide keys, so go back to the tree.
+        free_index(t);
     }
-
 }
 
 // This visits every node in an in-order traversal,
@@ -124,11 +808,589 @@ void traverse_node(tree_node *t, void (*f)(void *, void *, void *), void *contex
         return; 
     }
     traverse_node(t->left,f,context); //otherwise we call on traverse_node to traverse through contents of left 
-    f(t->key,t->data,context); 
+    if (!t->deleted) { //erased entries waiting for tree_compact are skipped 
+        f(t->key,t->data,context); 
+    }
     traverse_node(t->right,f,context); //or else right 
 }
 
 void traverse(tree *t, void (*f)(void *, void *, void *), void *context)
 {
-    traverse_node(t->root,f,context); //to traverse through the tree then we call back on traverse_node to traverse starting from the root 
-}
\ No newline at end of file
+    long *reading = read_lock(t);
+    traverse_node(read_root(t),f,context); //to traverse through the tree then we call back on traverse_node to traverse starting from the root 
+    read_unlock(reading);
+}
+
+// Unlinks the node *link points at.  A node with two children is
+// replaced by its in-order successor, which is moved rather than
+// copied so that no other node changes identity.  If sizes is set,
+// the sizes below *link are kept right; the caller fixes the ones
+// above.
+static void unlink_node(tree_node **link, bool sizes)
+{
+    tree_node *n = *link;
+    if (n->left == NULL) {
+        *link = n->right;
+    } else if (n->right == NULL) {
+        *link = n->left;
+    } else {
+        tree_node **successor_link = &n->right;
+        while ((*successor_link)->left != NULL) {
+            successor_link = &(*successor_link)->left;
+        }
+        tree_node *successor = *successor_link;
+        if (sizes) {
+            for (tree_node *m = n->right; m != successor; m = m->left) {
+                m->size -= live(successor);
+            }
+            successor->size = n->size - live(n);
+        }
+        *successor_link = successor->right;
+        successor->left = n->left;
+        successor->right = n->right;
+        *link = successor;
+    }
+}
+
+// Removes or marks the node for key in a concurrent tree, by copying
+// the path to it like insert_concurrent does.  If tombstone is set the
+// node is only marked.  Only live nodes are touched unless
+// only_tombstones is set, in which case only marked ones are.
+static bool erase_concurrent(tree *t, const void *key, bool tombstone, bool only_tombstones)
+{
+    uint64_t cache = cache_key(t, key);
+    node_path p = {NULL, 0, 0};
+    bool ok = true;
+    tree_node *n = record_path(t, t->root, key, cache, &p, &ok);
+    if (n == NULL || n->deleted != only_tombstones) {
+        free(p.nodes);
+        return false;
+    }
+    // n's slot is set before the copy below, so the copy has it too.
+    // Readers never look at tombstone_slot.
+    if (tombstone && !queue_tombstone(t, n)) {
+        tombstone = false;
+    }
+    size_t above = p.len - 1;
+    tree_node **copies = NULL;
+    tree_node *root = NULL;
+
+    if (tombstone) {
+        copies = copy_path(&p, p.len);
+        if (copies != NULL) {
+            copies[above]->deleted = true;
+            for (size_t i = 0; t->order_stats && i < p.len; i++) {
+                copies[i]->size--;
+            }
+            root = copies[0];
+        }
+    } else if (n->left == NULL || n->right == NULL) {
+        tree_node *replacement = n->left != NULL ? n->left : n->right;
+        copies = copy_path(&p, above);
+        for (size_t i = 0; copies != NULL && t->order_stats && i < above; i++) {
+            copies[i]->size -= live(n);
+        }
+        if (copies != NULL && above > 0) {
+            replace_child(copies[above - 1], n, replacement);
+            root = copies[0];
+        } else if (copies != NULL) {
+            root = replacement;
+        }
+    } else {
+        // Everything from n->right down to the successor gets copied
+        // too, since the successor's parent loses its left child.
+        tree_node *successor = n->right;
+        while (ok && successor != NULL) {
+            ok = path_push(&p, successor);
+            successor = successor->left;
+        }
+        copies = ok ? copy_path(&p, p.len) : NULL;
+        if (copies != NULL) {
+            // copies[above] is a throwaway copy of n that only links
+            // the path together; the last copy is the successor.
+            tree_node *moved = copies[p.len - 1];
+            for (size_t i = 0; t->order_stats && i < p.len - 1; i++) {
+                copies[i]->size -= i < above ? live(n) : live(moved);
+            }
+            moved->size = n->size - live(n);
+            if (p.len - 1 > above + 1) {
+                copies[p.len - 2]->left = moved->right;
+                moved->right = copies[above + 1];
+            }
+            moved->left = n->left;
+            if (above > 0) {
+                replace_child(copies[above - 1], copies[above], moved);
+                root = copies[0];
+            } else {
+                root = moved;
+            }
+            free(copies[above]);
+        }
+    }
+    if (copies == NULL) {
+        if (tombstone) {
+            // n stays live, so its key must not stay queued.
+            t->num_tombstones--;
+        }
+        free(p.nodes);
+        return false;
+    }
+    swap_root(t, root, &p, p.len);
+    free(copies);
+    free(p.nodes);
+    return true;
+}
+
+// Unlinks and frees the node for key, if it is there and its deleted
+// flag matches only_tombstones.
+static bool remove_node(tree *t, const void *key, bool only_tombstones)
+{
+    if (t->sync != NULL) {
+        return erase_concurrent(t, key, false, only_tombstones);
+    }
+    uint64_t cache = cache_key(t, key);
+    tree_node **link = &t->root;
+    while (*link != NULL) {
+        int cmp = compare_key(t, key, cache, *link);
+        if (cmp == 0) {
+            break;
+        }
+        link = cmp < 0 ? &(*link)->left : &(*link)->right;
+    }
+    tree_node *n = *link;
+    if (n == NULL || n->deleted != only_tombstones) {
+        return false;
+    }
+    if (t->order_stats) {
+        adjust_sizes(t, key, cache, -(long)live(n), false);
+    }
+    unlink_node(link, t->order_stats);
+    if (t->index != NULL) {
+        index_remove(t->index, n);
+    }
+    free(n);
+    return true;
+}
+
+bool tree_erase(tree *t, const void *key)
+{
+    if (!t->lazy_delete) {
+        return remove_node(t, key, false);
+    }
+    if (t->sync != NULL) {
+        return erase_concurrent(t, key, true, false);
+    }
+    tree_node *n = find_node(t, t->root, key);
+    if (n == NULL || n->deleted) {
+        return false;
+    }
+    if (!queue_tombstone(t, n)) {
+        // No room to remember it, so take it out right away.
+        return remove_node(t, key, false);
+    }
+    n->deleted = true;
+    if (t->order_stats) {
+        adjust_sizes(t, key, cache_key(t, key), -1, true);
+    }
+    return true;
+}
+
+void tree_set_lazy_delete(tree *t, bool lazy)
+{
+    t->lazy_delete = lazy;
+}
+
+size_t tree_compact(tree *t, size_t max_work)
+{
+    while (max_work > 0 && t->num_tombstones > 0) {
+        // Entries for keys that came back are NULL.  Each other one is
+        // the key of a node that is still a tombstone.
+        void *key = t->tombstones[--t->num_tombstones];
+        if (key != NULL) {
+            remove_node(t, key, true);
+        }
+        max_work--;
+    }
+    if (t->num_tombstones == 0) {
+        free(t->tombstones);
+        t->tombstones = NULL;
+        t->tombstone_capacity = 0;
+    }
+    return t->num_tombstones;
+}
+
+// Recounts the sizes under n from scratch.
+static size_t count_sizes(tree_node *n)
+{
+    if (n == NULL) {
+        return 0;
+    }
+    n->size = count_sizes(n->left) + live(n) + count_sizes(n->right);
+    return n->size;
+}
+
+void tree_enable_order_statistics(tree *t)
+{
+    if (!t->order_stats) {
+        count_sizes(t->root);
+        t->order_stats = true;
+    }
+}
+
+size_t tree_size(tree *t)
+{
+    long *reading = read_lock(t);
+    size_t size = size_of(read_root(t));
+    read_unlock(reading);
+    return size;
+}
+
+// The number of keys below key, also counting key itself if inclusive
+// is set and it is in the tree.
+static size_t count_below(tree *t, const void *key, bool inclusive)
+{
+    uint64_t cache = cache_key(t, key);
+    size_t below = 0;
+    long *reading = read_lock(t);
+    tree_node *n = read_root(t);
+    while (n != NULL) {
+        int cmp = compare_key(t, key, cache, n);
+        if (cmp < 0) {
+            n = n->left;
+        } else if (cmp == 0) {
+            below += size_of(n->left) + (inclusive ? live(n) : 0);
+            break;
+        } else {
+            below += size_of(n->left) + live(n);
+            n = n->right;
+        }
+    }
+    read_unlock(reading);
+    return below;
+}
+
+size_t tree_rank(tree *t, const void *key)
+{
+    return count_below(t, key, false);
+}
+
+void *tree_select(tree *t, size_t i, void **data)
+{
+    void *key = NULL;
+    long *reading = read_lock(t);
+    tree_node *n = read_root(t);
+    while (n != NULL) {
+        size_t left = size_of(n->left);
+        if (i < left) {
+            n = n->left;
+        } else if (i == left && !n->deleted) {
+            key = n->key;
+            if (data != NULL) {
+                *data = n->data;
+            }
+            break;
+        } else {
+            i -= left + live(n);
+            n = n->right;
+        }
+    }
+    read_unlock(reading);
+    return key;
+}
+
+size_t tree_count_range(tree *t, const void *lo, const void *hi)
+{
+    size_t upto = count_below(t, hi, true);
+    size_t below = count_below(t, lo, false);
+    return upto > below ? upto - below : 0;
+}
+
+// traverse_parallel cuts the tree into about this many pieces per
+// thread, so that there is something left to steal near the end.
+#define TRAVERSE_CHUNKS_PER_THREAD 16
+
+// In ordered mode, at most this many pieces per thread may be finished
+// but waiting for an earlier piece before they can be merged.
+#define TRAVERSE_WINDOW_PER_THREAD 4
+
+// One piece of a parallel traversal: either a single node or a node
+// and everything below it.
+typedef struct traverse_chunk {
+    tree_node *node;
+    bool whole;
+} traverse_chunk;
+
+// Each thread owns the pieces [lo, hi).  The owner takes from lo;
+// thieves take from hi, or from lo when the traversal is ordered so
+// that the earliest pieces go first.
+typedef struct traverse_deque {
+    pthread_mutex_t lock;
+    size_t lo;
+    size_t hi;
+} traverse_deque;
+
+typedef struct parallel_traversal {
+    void (*f)(void *, void *, void *);
+    void *context;
+    const traverse_ops *ops;
+    traverse_chunk *chunks;
+    size_t num_chunks;
+    traverse_deque *deques;
+    int nthreads;
+
+    // Ordered mode: finished pieces wait in window[seq % window_size]
+    // until every piece before them has been merged.
+    pthread_mutex_t merge_lock;
+    pthread_cond_t merged;
+    void **window;
+    bool *finished;
+    size_t window_size;
+    size_t next_merge;
+} parallel_traversal;
+
+typedef struct traverse_worker {
+    parallel_traversal *p;
+    int id;
+    void *local;
+} traverse_worker;
+
+// Cuts the tree into in-order pieces by repeatedly splitting every
+// whole subtree into (left, node, right) until there are enough.
+static traverse_chunk *split_tree(tree_node *root, size_t target, size_t *count)
+{
+    size_t n = 0;
+    traverse_chunk *chunks = (traverse_chunk *)malloc(sizeof(traverse_chunk));
+    if (chunks == NULL) {
+        return NULL;
+    }
+    if (root != NULL) {
+        chunks[n].node = root;
+        chunks[n].whole = true;
+        n++;
+    }
+    bool split = true;
+    while (n < target && split) {
+        traverse_chunk *next = (traverse_chunk *)malloc(3 * n * sizeof(traverse_chunk));
+        if (next == NULL) {
+            break;
+        }
+        size_t m = 0;
+        split = false;
+        for (size_t i = 0; i < n; i++) {
+            tree_node *node = chunks[i].node;
+            if (!chunks[i].whole || (node->left == NULL && node->right == NULL)) {
+                next[m++] = chunks[i];
+                continue;
+            }
+            split = true;
+            if (node->left != NULL) {
+                next[m].node = node->left;
+                next[m++].whole = true;
+            }
+            next[m].node = node;
+            next[m++].whole = false;
+            if (node->right != NULL) {
+                next[m].node = node->right;
+                next[m++].whole = true;
+            }
+        }
+        free(chunks);
+        chunks = next;
+        n = m;
+    }
+    *count = n;
+    return chunks;
+}
+
+static void run_chunk(parallel_traversal *p, traverse_chunk *c, void *context)
+{
+    if (c->whole) {
+        traverse_node(c->node, p->f, context);
+    } else if (!c->node->deleted) {
+        p->f(c->node->key, c->node->data, context);
+    }
+}
+
+// Ordered mode only lets a piece start once it fits in the window.
+static bool in_window(parallel_traversal *p, size_t seq)
+{
+    if (p->window == NULL) {
+        return true;
+    }
+    return seq < __atomic_load_n(&p->next_merge, __ATOMIC_ACQUIRE) + p->window_size;
+}
+
+// Takes a piece from the worker's own deque, or steals one.  Returns
+// false once there is nothing left to start.  In ordered mode it can
+// wait for earlier pieces to be merged before returning.
+static bool claim_chunk(parallel_traversal *p, int id, size_t *seq)
+{
+    for (;;) {
+        bool left_over = false;
+        for (int i = 0; i < p->nthreads; i++) {
+            traverse_deque *d = &p->deques[(id + i) % p->nthreads];
+            bool claimed = false;
+            pthread_mutex_lock(&d->lock);
+            if (d->lo < d->hi) {
+                left_over = true;
+                if (i == 0 || p->window != NULL) {
+                    if (in_window(p, d->lo)) {
+                        *seq = d->lo++;
+                        claimed = true;
+                    }
+                } else {
+                    *seq = --d->hi;
+                    claimed = true;
+                }
+            }
+            pthread_mutex_unlock(&d->lock);
+            if (claimed) {
+                return true;
+            }
+        }
+        if (!left_over) {
+            return false;
+        }
+        // Everything left is too far ahead of the merge point.  The
+        // piece at next_merge is already running, so wait for it.
+        size_t seen = __atomic_load_n(&p->next_merge, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&p->merge_lock);
+        while (p->next_merge == seen) {
+            pthread_cond_wait(&p->merged, &p->merge_lock);
+        }
+        pthread_mutex_unlock(&p->merge_lock);
+    }
+}
+
+// Hands a finished piece to the window and merges every piece that is
+// now next in line.
+static void finish_ordered(parallel_traversal *p, size_t seq, void *local)
+{
+    pthread_mutex_lock(&p->merge_lock);
+    p->window[seq % p->window_size] = local;
+    p->finished[seq % p->window_size] = true;
+    bool advanced = false;
+    while (p->next_merge < p->num_chunks && p->finished[p->next_merge % p->window_size]) {
+        size_t slot = p->next_merge % p->window_size;
+        p->ops->merge_context(p->context, p->window[slot]);
+        p->ops->free_context(p->window[slot]);
+        p->finished[slot] = false;
+        __atomic_store_n(&p->next_merge, p->next_merge + 1, __ATOMIC_RELEASE);
+        advanced = true;
+    }
+    if (advanced) {
+        pthread_cond_broadcast(&p->merged);
+    }
+    pthread_mutex_unlock(&p->merge_lock);
+}
+
+static void *traverse_worker_main(void *arg)
+{
+    traverse_worker *w = (traverse_worker *)arg;
+    parallel_traversal *p = w->p;
+    size_t seq;
+    while (claim_chunk(p, w->id, &seq)) {
+        if (p->ops == NULL) {
+            run_chunk(p, &p->chunks[seq], p->context);
+        } else if (p->ops->ordered) {
+            void *local = p->ops->new_context(p->context);
+            run_chunk(p, &p->chunks[seq], local);
+            finish_ordered(p, seq, local);
+        } else {
+            run_chunk(p, &p->chunks[seq], w->local);
+        }
+    }
+    return NULL;
+}
+
+void traverse_parallel(tree *t, void (*f)(void *, void *, void *), void *context,
+                       const traverse_ops *ops, int nthreads)
+{
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    long *reading = read_lock(t);
+    parallel_traversal p;
+    memset(&p, 0, sizeof(p));
+    p.f = f;
+    p.context = context;
+    p.ops = ops;
+    p.nthreads = nthreads;
+    p.chunks = split_tree(read_root(t), (size_t)nthreads * TRAVERSE_CHUNKS_PER_THREAD, &p.num_chunks);
+    p.deques = (traverse_deque *)calloc(nthreads, sizeof(traverse_deque));
+    traverse_worker *workers = (traverse_worker *)calloc(nthreads, sizeof(traverse_worker));
+    pthread_t *threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    if (ops != NULL && ops->ordered) {
+        p.window_size = (size_t)nthreads * TRAVERSE_WINDOW_PER_THREAD;
+        p.window = (void **)calloc(p.window_size, sizeof(void *));
+        p.finished = (bool *)calloc(p.window_size, sizeof(bool));
+    }
+    if (p.chunks == NULL || p.deques == NULL || workers == NULL || threads == NULL ||
+        (ops != NULL && ops->ordered && (p.window == NULL || p.finished == NULL))) {
+        // Not enough memory to split the work up; do it all here.
+        read_unlock(reading);
+        free(p.chunks);
+        free(p.deques);
+        free(workers);
+        free(threads);
+        free(p.window);
+        free(p.finished);
+        if (ops == NULL) {
+            traverse(t, f, context);
+        } else {
+            void *local = ops->new_context(context);
+            traverse(t, f, local);
+            ops->merge_context(context, local);
+            ops->free_context(local);
+        }
+        return;
+    }
+    pthread_mutex_init(&p.merge_lock, NULL);
+    pthread_cond_init(&p.merged, NULL);
+
+    // Deal the pieces out in contiguous runs so each thread mostly
+    // walks neighbouring parts of the tree.
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&p.deques[i].lock, NULL);
+        p.deques[i].lo = p.num_chunks * i / nthreads;
+        p.deques[i].hi = p.num_chunks * (i + 1) / nthreads;
+        workers[i].p = &p;
+        workers[i].id = i;
+        if (ops != NULL && !ops->ordered) {
+            workers[i].local = ops->new_context(context);
+        }
+    }
+    int started = 1;
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, traverse_worker_main, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    // Threads that failed to start still have deques, which the rest
+    // of the workers steal from.
+    traverse_worker_main(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (ops != NULL && !ops->ordered) {
+        for (int i = 0; i < nthreads; i++) {
+            ops->merge_context(context, workers[i].local);
+            ops->free_context(workers[i].local);
+        }
+    }
+    read_unlock(reading);
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_destroy(&p.deques[i].lock);
+    }
+    pthread_mutex_destroy(&p.merge_lock);
+    pthread_cond_destroy(&p.merged);
+    free(p.chunks);
+    free(p.deques);
+    free(p.window);
+    free(p.finished);
+    free(workers);
+    free(threads);
+}
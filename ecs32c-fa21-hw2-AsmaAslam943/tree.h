@@ -2,26 +2,90 @@
 #define _TREE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+// What a tree knows about its keys.  Generic trees only ever call
+// comparison_fn.  The other kinds compare keys inline instead.
+typedef enum tree_key_kind {
+    TREE_KEY_GENERIC,
+    // Each key points to an int64_t.
+    TREE_KEY_INT64,
+    // Each key is a C string, ordered as strcmp orders them.
+    TREE_KEY_STRING
+} tree_key_kind;
+
 typedef struct tree_node
 {
     void *key;
     void *data;
     struct tree_node *left;
     struct tree_node *right;
+    // Int64 trees keep the key's value here and string trees keep its
+    // first 8 bytes, packed so that comparing two of these as numbers
+    // orders them the same way strcmp would.  Most comparisons never
+    // have to follow key.  Unused in generic trees.
+    uint64_t key_cache;
+    // Set on nodes erased in lazy delete mode.  They stay linked into
+    // the tree, invisible to lookups, until tree_compact removes them.
+    bool deleted;
+    // Where a deleted node's key sits in the tree's tombstones, so that
+    // insert can take it out again when the key comes back.
+    unsigned int tombstone_slot;
+    // With order statistics on, the number of live (not deleted) nodes
+    // in the subtree under and including this one.
+    size_t size;
 } tree_node;
 
+// Reader tracking and retired nodes for concurrent trees, private
+// to tree.c.
+struct tree_sync;
+
+// The optional hash table from keys to nodes, private to tree.c.
+struct tree_hash_index;
+
 typedef struct tree {
     struct tree_node *root;
     int (*comparison_fn)(const void*, const void*);
+    tree_key_kind key_kind;
+    // NULL unless the tree was made with new_concurrent_tree().
+    struct tree_sync *sync;
+    // See tree_set_lazy_delete.  tombstones holds the keys of nodes
+    // that are marked deleted but not yet removed, and NULL where one
+    // has since come back.
+    bool lazy_delete;
+    void **tombstones;
+    size_t num_tombstones;
+    size_t tombstone_capacity;
+    // See tree_enable_order_statistics.
+    bool order_stats;
+    // See tree_enable_hash_index.  NULL unless it's on.
+    struct tree_hash_index *index;
 } tree;
 
 // Allocates a new tree with the specified comparison function.
 tree * new_tree(int (*comparison_fn)(const void*, const void*));
 
+// Allocates a tree that allows one writer to run at the same time as
+// any number of readers.  contains/find/traverse never take a lock:
+// each call works on a consistent snapshot of the tree.  insert copies
+// the path from the root to the changed node and publishes the new
+// root, so readers never see a half-built tree.  Replaced nodes are
+// freed in batches once every reader that could still see them has
+// finished.  Writers must still be serialized by the caller.
+tree * new_concurrent_tree(int (*comparison_fn)(const void*, const void*));
+
+// Allocates a tree of int64_t keys or of C string keys.  The tree has
+// a matching comparison_fn, so it works with every function here; it
+// just doesn't call it on lookups and inserts.
+tree * new_int64_tree(void);
+tree * new_string_tree(void);
+
+// The general form of the constructors above.
+tree * new_tree_for_keys(tree_key_kind kind, bool concurrent);
+
 // Frees the tree and all its nodes, but does not free the keys 
-// or data.
+// or data.  For a concurrent tree no reader may still be running.
 void free_tree(tree *t);
 
 // Returns true if the key (comparison == 0) is in the tree
@@ -39,6 +103,82 @@ void insert(tree *t, void *key, void *data);
 // between calls.
 void traverse(tree *t, void (*f)(void *, void *, void *), void *context);
 
+// Removes the key from the tree, returning false if it wasn't there.
+// Like free_tree, this doesn't free the key or data.
+bool tree_erase(tree *t, const void *key);
+
+// In lazy delete mode tree_erase just marks the node as deleted, which
+// is a lookup rather than a relinking of the tree.  contains, find and
+// traverse skip marked nodes and insert brings them back.  The key of
+// a marked node must stay valid until tree_compact has dealt with it.
+void tree_set_lazy_delete(tree *t, bool lazy);
+
+// Physically removes up to max_work of the nodes marked by tree_erase,
+// so the cost of each call is bounded.  Returns how many marked nodes
+// are still waiting.  Call it from wherever it is cheap to do a
+// little work, e.g. after each batch of requests.
+size_t tree_compact(tree *t, size_t max_work);
+
+// Starts keeping a count of live keys under every node, which costs a
+// second walk down the tree on inserts and erases but lets the queries
+// below run in time proportional to the height of the tree rather
+// than its size.  Counting existing nodes is a full traversal, so
+// it's cheapest to call this on an empty tree.  For a concurrent tree
+// it must be called before any readers start.
+void tree_enable_order_statistics(tree *t);
+
+// The following need order statistics to be on.
+
+// Returns the number of keys in the tree.
+size_t tree_size(tree *t);
+
+// Returns the number of keys less than key.
+size_t tree_rank(tree *t, const void *key);
+
+// Returns the i'th smallest key (starting from 0) and, if data is not
+// NULL, stores its data there.  Returns NULL if i >= tree_size(t).
+void *tree_select(tree *t, size_t i, void **data);
+
+// Returns the number of keys k with lo <= k <= hi.
+size_t tree_count_range(tree *t, const void *lo, const void *hi);
+
+// Keeps an open addressing hash table from keys to nodes alongside the
+// tree, so contains and find are a hash and a probe or two instead of a
+// walk down the tree.  Everything ordered still uses the tree.  Each
+// node costs one more table slot (16 bytes, with the table between a
+// quarter and a half full) and inserts and erases do the table update
+// on top of the tree walk.  Keys that compare equal must hash the same.
+// Int64 and string trees may pass NULL to use a built in hash.  Not
+// available for concurrent trees; returns false if it can't be turned
+// on.
+bool tree_enable_hash_index(tree *t, uint64_t (*hash_fn)(const void *key));
+
+// How traverse_parallel gives each thread its own context.  Every
+// piece of work gets a fresh context from new_context(context), f runs
+// against that, and the result is folded back with
+// merge_context(context, local) before free_context(local).
+// new_context may be called from several threads at once; merges
+// happen one at a time.
+typedef struct traverse_ops {
+    void *(*new_context)(void *context);
+    void (*merge_context)(void *context, void *local);
+    void (*free_context)(void *local);
+    // If false, each thread keeps one context for all its work and the
+    // contexts are merged at the end.  If true, the tree is cut into
+    // in-order pieces with a context each, and the pieces are merged
+    // strictly in key order, holding at most a few pieces per thread
+    // while earlier ones finish.
+    bool ordered;
+} traverse_ops;
+
+// Like traverse, but the tree is split into subtrees that nthreads
+// threads (including the caller) work through, stealing from each
+// other when they run dry.  With ops == NULL, f gets context directly
+// and may be called from several threads at the same time.  Within
+// one piece of work f still sees keys in order.
+void traverse_parallel(tree *t, void (*f)(void *, void *, void *), void *context,
+                       const traverse_ops *ops, int nthreads);
+
 
 
 
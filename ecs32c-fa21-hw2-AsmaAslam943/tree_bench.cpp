@@ -0,0 +1,332 @@
+// Benchmarks for the C tree.  These are not part of the test suite,
+// run them by hand from the build directory:
+//
+//   ./treebench                 runs everything
+//   ./treebench readscale [n]   lookup throughput vs. reader threads
+//   ./treebench ptraverse [n]   traverse vs. traverse_parallel with a
+//                               costly callback
+//   ./treebench keys [n]        generic vs. int64/string key trees
+//   ./treebench hashindex [n]   cost and benefit of tree_enable_hash_index
+//
+// n is the number of keys in the tree (default 1000000).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <malloc.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include "tree.h"
+
+int longcmp(const void *a, const void *b){
+    long x = *(const long *) a;
+    long y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+// Stands in for a real callback that serializes or hashes each entry.
+void hash_entry(void *key, void *data, void *context){
+    (void) data;
+    unsigned long h = (unsigned long) *(long *) key;
+    for (int i = 0; i < 200; ++i) {
+        h = h * 6364136223846793005UL + 1442695040888963407UL;
+    }
+    *(unsigned long *) context ^= h;
+}
+
+void *new_hash(void *context){
+    (void) context;
+    return calloc(1, sizeof(unsigned long));
+}
+
+void merge_hash(void *context, void *local){
+    *(unsigned long *) context ^= *(unsigned long *) local;
+}
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Even keys go in up front, odd keys are what the background writer
+// adds, so lookups always hit and writes always add new nodes.
+static std::vector<long> make_keys(size_t n)
+{
+    std::vector<long> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = (long) i * 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine{42});
+    return keys;
+}
+
+// Lookups per second with nthreads readers hammering the tree while one
+// writer inserts writes_per_sec new keys.  With locked set, every call
+// goes through one mutex, which is how the tree had to be shared before
+// new_concurrent_tree().
+static double read_throughput(size_t n, int nthreads, bool locked, long writes_per_sec)
+{
+    std::vector<long> keys = make_keys(n);
+    std::vector<long> extra(1 << 20);
+    for (size_t i = 0; i < extra.size(); ++i) {
+        extra[i] = (long) (std::hash<size_t>{}(i) % (n * 2)) | 1;
+    }
+    tree *t = locked ? new_tree(longcmp) : new_concurrent_tree(longcmp);
+    for (auto &k : keys) {
+        insert(t, &k, &k);
+    }
+
+    std::mutex m;
+    std::atomic<bool> done{false};
+    std::atomic<long> lookups{0};
+
+    std::thread writer([&]() {
+        auto start = bench_clock::now();
+        size_t written = 0;
+        while (!done.load(std::memory_order_relaxed) && written < extra.size()) {
+            long due = (long) (seconds_since(start) * writes_per_sec);
+            while ((long) written < due && written < extra.size()) {
+                long *k = &extra[written++];
+                if (locked) {
+                    std::lock_guard<std::mutex> g(m);
+                    insert(t, k, k);
+                } else {
+                    insert(t, k, k);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < nthreads; ++r) {
+        readers.emplace_back([&, r]() {
+            std::minstd_rand rng(r + 1);
+            long count = 0;
+            void *sink = nullptr;
+            while (!done.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; ++i) {
+                    long *k = &keys[rng() % n];
+                    if (locked) {
+                        std::lock_guard<std::mutex> g(m);
+                        sink = find(t, k);
+                    } else {
+                        sink = find(t, k);
+                    }
+                }
+                count += 256;
+            }
+            if (sink == nullptr) {
+                fprintf(stderr, "lookup missed\n");
+            }
+            lookups += count;
+        });
+    }
+
+    auto start = bench_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    done = true;
+    for (auto &th : readers) {
+        th.join();
+    }
+    double elapsed = seconds_since(start);
+    writer.join();
+    free_tree(t);
+    return lookups.load() / elapsed;
+}
+
+static void bench_readscale(size_t n)
+{
+    const long writes_per_sec = 20000;
+    int max_threads = std::max(2u, std::thread::hardware_concurrency());
+    printf("readscale: %zu keys, %ld background inserts/s\n", n, writes_per_sec);
+    printf("%8s %16s %16s\n", "threads", "mutex lookups/s", "rcu lookups/s");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double locked = read_throughput(n, threads, true, writes_per_sec);
+        double concurrent = read_throughput(n, threads, false, writes_per_sec);
+        printf("%8d %16.0f %16.0f\n", threads, locked, concurrent);
+    }
+}
+
+static void bench_ptraverse(size_t n)
+{
+    std::vector<long> keys = make_keys(n);
+    tree *t = new_tree(longcmp);
+    for (auto &k : keys) {
+        insert(t, &k, &k);
+    }
+    int max_threads = std::max(2u, std::thread::hardware_concurrency());
+    printf("ptraverse: %zu keys\n", n);
+
+    unsigned long expected = 0;
+    auto start = bench_clock::now();
+    traverse(t, hash_entry, &expected);
+    printf("%-24s %10.3f s\n", "traverse", seconds_since(start));
+
+    for (bool ordered : {false, true}) {
+        traverse_ops ops = {new_hash, merge_hash, free, ordered};
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            unsigned long h = 0;
+            start = bench_clock::now();
+            traverse_parallel(t, hash_entry, &h, &ops, threads);
+            double elapsed = seconds_since(start);
+            char label[64];
+            snprintf(label, sizeof(label), "%s x%d", ordered ? "ordered" : "unordered", threads);
+            printf("%-24s %10.3f s%s\n", label, elapsed, h == expected ? "" : "  (MISMATCH)");
+        }
+    }
+    free_tree(t);
+}
+
+// Seconds to look up every key in probes once.
+template <class Key>
+static double time_lookups(tree *t, std::vector<Key> &probes)
+{
+    void *sink = nullptr;
+    auto start = bench_clock::now();
+    for (auto &p : probes) {
+        sink = find(t, p);
+    }
+    double elapsed = seconds_since(start);
+    if (sink == nullptr) {
+        fprintf(stderr, "lookup missed\n");
+    }
+    return elapsed;
+}
+
+static void bench_keys(size_t n)
+{
+    printf("keys: %zu keys, lookups/s\n", n);
+
+    std::vector<long> numbers = make_keys(n);
+    std::vector<long *> probes;
+    for (auto &k : numbers) {
+        probes.push_back(&k);
+    }
+    std::shuffle(probes.begin(), probes.end(), std::default_random_engine{7});
+    tree *generic = new_tree(longcmp);
+    tree *ints = new_int64_tree();
+    for (auto &k : numbers) {
+        insert(generic, &k, &k);
+        insert(ints, &k, &k);
+    }
+    printf("%-28s %14.0f\n", "int64 via comparison_fn", n / time_lookups(generic, probes));
+    printf("%-28s %14.0f\n", "int64 tree", n / time_lookups(ints, probes));
+    free_tree(generic);
+    free_tree(ints);
+
+    // Keys with a shared leading part, like paths or URLs, and ones
+    // that differ early.
+    for (const char *prefix : {"", "/srv/data/"}) {
+        std::vector<std::string> words;
+        for (long k : numbers) {
+            words.push_back(prefix + std::to_string(k * 7919));
+        }
+        std::vector<const char *> word_probes;
+        for (auto &w : words) {
+            word_probes.push_back(w.c_str());
+        }
+        std::shuffle(word_probes.begin(), word_probes.end(), std::default_random_engine{7});
+        tree *plain = new_tree((int (*)(const void *, const void *)) strcmp);
+        tree *strings = new_string_tree();
+        for (auto &w : words) {
+            insert(plain, (void *) w.c_str(), (void *) w.c_str());
+            insert(strings, (void *) w.c_str(), (void *) w.c_str());
+        }
+        std::string label = std::string("strcmp \"") + prefix + "...\"";
+        printf("%-28s %14.0f\n", label.c_str(), n / time_lookups(plain, word_probes));
+        label = std::string("string tree \"") + prefix + "...\"";
+        printf("%-28s %14.0f\n", label.c_str(), n / time_lookups(strings, word_probes));
+        free_tree(plain);
+        free_tree(strings);
+    }
+}
+
+static size_t heap_in_use()
+{
+    // Big blocks like the index table come straight from mmap and are
+    // only counted in hblkhd.
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static void bench_hashindex(size_t n)
+{
+    printf("hashindex: %zu int64 keys\n", n);
+    printf("%-10s %12s %14s %14s %14s\n", "index", "heap MB", "inserts/s", "hits/s", "misses/s");
+    std::vector<long> numbers = make_keys(n);
+    std::vector<long> misses(n);
+    for (size_t i = 0; i < n; ++i) {
+        misses[i] = numbers[i] + 1;
+    }
+    std::vector<long *> hit_probes, miss_probes;
+    for (size_t i = 0; i < n; ++i) {
+        hit_probes.push_back(&numbers[i]);
+        miss_probes.push_back(&misses[i]);
+    }
+    std::shuffle(hit_probes.begin(), hit_probes.end(), std::default_random_engine{7});
+
+    for (bool indexed : {false, true}) {
+        size_t heap_before = heap_in_use();
+        tree *t = new_int64_tree();
+        if (indexed) {
+            tree_enable_hash_index(t, NULL);
+        }
+        auto start = bench_clock::now();
+        for (auto &k : numbers) {
+            insert(t, &k, &k);
+        }
+        double insert_time = seconds_since(start);
+        double heap_mb = (heap_in_use() - heap_before) / 1048576.0;
+
+        start = bench_clock::now();
+        size_t hits = 0;
+        for (long *k : hit_probes) {
+            hits += contains(t, k);
+        }
+        double hit_time = seconds_since(start);
+        start = bench_clock::now();
+        for (long *k : miss_probes) {
+            hits += contains(t, k);
+        }
+        double miss_time = seconds_since(start);
+        if (hits != n) {
+            fprintf(stderr, "wrong lookup results\n");
+        }
+        printf("%-10s %12.1f %14.0f %14.0f %14.0f\n", indexed ? "on" : "off", heap_mb,
+               n / insert_time, n / hit_time, n / miss_time);
+        free_tree(t);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string which = argc > 1 ? argv[1] : "all";
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    if (which == "all" || which == "readscale") {
+        bench_readscale(n);
+    }
+    if (which == "all" || which == "ptraverse") {
+        bench_ptraverse(n);
+    }
+    if (which == "all" || which == "keys") {
+        bench_keys(n);
+    }
+    if (which == "all" || which == "hashindex") {
+        bench_hashindex(n);
+    }
+    return 0;
+}
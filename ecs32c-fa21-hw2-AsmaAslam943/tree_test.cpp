@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <string>
 
 extern "C"
 {
@@ -17,6 +21,76 @@ void cat(void *key, void *data, void *context){
     strcat(str, ",");
 }
 
+int intcmp(const void *a, const void *b){
+    long x = *(const long *) a;
+    long y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+// Context for check_sorted: counts nodes and notes any out-of-order key.
+typedef struct sorted_check {
+    long last;
+    long count;
+    bool sorted;
+} sorted_check;
+
+void check_sorted(void *key, void *data, void *context){
+    (void) data;
+    sorted_check *c = (sorted_check *) context;
+    long k = *(long *) key;
+    if (c->count > 0 && k <= c->last) {
+        c->sorted = false;
+    }
+    c->last = k;
+    c->count++;
+}
+
+
+// Contexts for the traverse_parallel tests: a running total, unsigned
+// so that it wraps rather than overflows, and the keys in the order
+// they were merged.
+typedef struct key_list {
+    unsigned long sum;
+    std::vector<long> *keys;
+} key_list;
+
+void collect(void *key, void *data, void *context){
+    (void) data;
+    key_list *l = (key_list *) context;
+    l->sum += *(long *) key;
+    l->keys->push_back(*(long *) key);
+}
+
+void *new_key_list(void *context){
+    (void) context;
+    key_list *l = (key_list *) malloc(sizeof(key_list));
+    l->sum = 0;
+    l->keys = new std::vector<long>();
+    return l;
+}
+
+void merge_key_list(void *context, void *local){
+    key_list *into = (key_list *) context;
+    key_list *from = (key_list *) local;
+    into->sum += from->sum;
+    into->keys->insert(into->keys->end(), from->keys->begin(), from->keys->end());
+}
+
+void free_key_list(void *local){
+    delete ((key_list *) local)->keys;
+    free(local);
+}
+
+// Deliberately poor hash so that probe runs get long.
+uint64_t low_bits_hash(const void *key){
+    return (uint64_t) (*(const long *) key % 8);
+}
+
+void count_nodes(void *key, void *data, void *context){
+    (void) key;
+    (void) data;
+    __atomic_fetch_add((long *) context, 1, __ATOMIC_RELAXED);
+}
 }
 
 TEST(C_LIST, BasicTests)
@@ -54,3 +128,364 @@ TEST(C_LIST, BasicTests)
 
 
 
+
+TEST(C_LIST, ConcurrentReaders)
+{
+    tree *t = new_concurrent_tree(intcmp);
+    std::vector<long> keys(5000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = (long) i;
+    }
+    auto rng = std::default_random_engine {};
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    // The first 1000 keys are there before the readers start and must
+    // be visible to every lookup.
+    for (size_t i = 0; i < 1000; ++i) {
+        insert(t, &keys[i], &keys[i]);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&, r]() {
+            long last_count = 0;
+            size_t i = r;
+            while (!done.load()) {
+                long *k = &keys[i % 1000];
+                if (find(t, k) != k || !contains(t, k)) {
+                    failures++;
+                }
+                if (i % 64 == 0) {
+                    sorted_check c = {0, 0, true};
+                    traverse(t, check_sorted, &c);
+                    if (!c.sorted || c.count < last_count) {
+                        failures++;
+                    }
+                    last_count = c.count;
+                }
+                i += 7;
+            }
+        });
+    }
+    for (size_t i = 1000; i < keys.size(); ++i) {
+        insert(t, &keys[i], &keys[i]);
+    }
+    // Updating an existing key swaps in a new path too.
+    insert(t, &keys[0], &keys[1]);
+    done = true;
+    for (auto &th : readers) {
+        th.join();
+    }
+
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(find(t, &keys[0]), &keys[1]);
+    sorted_check c = {0, 0, true};
+    traverse(t, check_sorted, &c);
+    EXPECT_TRUE(c.sorted);
+    EXPECT_EQ(c.count, (long) keys.size());
+    free_tree(t);
+}
+
+TEST(C_LIST, ParallelTraverse)
+{
+    tree *t = new_tree(intcmp);
+    std::vector<long> keys(3000);
+    unsigned long expected_sum = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = (long) i;
+        expected_sum += i;
+    }
+    auto rng = std::default_random_engine {};
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (auto &k : keys) {
+        insert(t, &k, &k);
+    }
+
+    for (int threads : {1, 3, 8}) {
+        for (bool ordered : {false, true}) {
+            traverse_ops ops = {new_key_list, merge_key_list, free_key_list, ordered};
+            std::vector<long> seen;
+            key_list result = {0, &seen};
+            traverse_parallel(t, collect, &result, &ops, threads);
+            EXPECT_EQ(result.sum, expected_sum);
+            ASSERT_EQ(seen.size(), keys.size());
+            if (ordered) {
+                for (size_t i = 0; i < seen.size(); ++i) {
+                    EXPECT_EQ(seen[i], (long) i);
+                }
+            } else {
+                std::sort(seen.begin(), seen.end());
+                EXPECT_EQ(seen.front(), 0);
+                EXPECT_EQ(seen.back(), (long) keys.size() - 1);
+            }
+        }
+        long count = 0;
+        traverse_parallel(t, count_nodes, &count, NULL, threads);
+        EXPECT_EQ(count, (long) keys.size());
+    }
+
+    // A tree built from sorted keys is one long chain.
+    tree *chain = new_tree(intcmp);
+    std::sort(keys.begin(), keys.end());
+    for (auto &k : keys) {
+        insert(chain, &k, &k);
+    }
+    traverse_ops ops = {new_key_list, merge_key_list, free_key_list, true};
+    std::vector<long> seen;
+    key_list result = {0, &seen};
+    traverse_parallel(chain, collect, &result, &ops, 4);
+    EXPECT_EQ(result.sum, expected_sum);
+    EXPECT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+
+    free_tree(chain);
+    free_tree(t);
+}
+
+TEST(C_LIST, KeyKinds)
+{
+    tree *ints = new_int64_tree();
+    std::vector<int64_t> numbers = {0, -1, 1, INT64_MIN, INT64_MAX, 42, -42, 1LL << 40, -(1LL << 40)};
+    for (auto &n : numbers) {
+        insert(ints, &n, &n);
+    }
+    for (auto &n : numbers) {
+        int64_t copy = n;
+        EXPECT_EQ(find(ints, &copy), &n);
+    }
+    int64_t missing = 7;
+    EXPECT_FALSE(contains(ints, &missing));
+    std::vector<long> order;
+    key_list l = {0, &order};
+    traverse(ints, collect, &l);
+    EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+    free_tree(ints);
+
+    // Strings that share, end inside, or run past the 8 byte prefix.
+    std::vector<std::string> words = {"", "a", "ab", "abcdefg", "abcdefgh", "abcdefghi",
+                                      "abcdefghij", "abcdefgi", "b", "\xff", "\xff\xff",
+                                      "zzzzzzzzzzzzzzzz", "zzzzzzzzzzzzzzzy"};
+    auto rng = std::default_random_engine {};
+    std::shuffle(words.begin(), words.end(), rng);
+    tree *strings = new_string_tree();
+    std::map<std::string, const char *> expected;
+    for (auto &w : words) {
+        insert(strings, (void *) w.c_str(), (void *) w.c_str());
+        expected[w] = w.c_str();
+    }
+    for (auto &w : words) {
+        std::string copy = w;
+        EXPECT_EQ(find(strings, copy.c_str()), (void *) w.c_str());
+    }
+    EXPECT_FALSE(contains(strings, "abcdefghk"));
+    EXPECT_FALSE(contains(strings, "abcdef"));
+
+    char *tmp = (char *) calloc(5000, 1);
+    traverse(strings, cat, tmp);
+    std::string want;
+    for (auto &[k, v] : expected) {
+        want += k + "/" + v + ",";
+    }
+    EXPECT_EQ(std::string(tmp), want);
+    free(tmp);
+    free_tree(strings);
+}
+
+TEST(C_LIST, EraseAndCompact)
+{
+    std::vector<int64_t> keys(2000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = (int64_t) i;
+    }
+    for (bool concurrent : {false, true}) {
+        for (bool lazy : {false, true}) {
+            tree *t = new_tree_for_keys(TREE_KEY_INT64, concurrent);
+            tree_set_lazy_delete(t, lazy);
+            std::map<int64_t, int64_t *> expected;
+            std::mt19937 rng(lazy * 2 + concurrent);
+            for (int step = 0; step < 20000; ++step) {
+                int64_t *k = &keys[rng() % keys.size()];
+                if (rng() % 3 == 0) {
+                    EXPECT_EQ(tree_erase(t, k), expected.erase(*k) == 1);
+                } else {
+                    insert(t, k, k);
+                    expected[*k] = k;
+                }
+                if (step % 100 == 0) {
+                    tree_compact(t, 10);
+                }
+            }
+            for (auto &k : keys) {
+                auto it = expected.find(k);
+                EXPECT_EQ(find(t, &k), it == expected.end() ? nullptr : it->second);
+            }
+            std::vector<long> seen;
+            key_list l = {0, &seen};
+            traverse(t, collect, &l);
+            ASSERT_EQ(seen.size(), expected.size());
+            size_t i = 0;
+            for (auto &[k, v] : expected) {
+                EXPECT_EQ(seen[i++], k);
+            }
+            if (lazy) {
+                // Compaction doesn't change what the tree holds.
+                while (tree_compact(t, 100) > 0) {
+                }
+                seen.clear();
+                traverse(t, collect, &l);
+                EXPECT_EQ(seen.size(), expected.size());
+            }
+            for (auto &[k, v] : expected) {
+                EXPECT_TRUE(tree_erase(t, v));
+            }
+            while (tree_compact(t, 100) > 0) {
+            }
+            EXPECT_EQ(t->root, nullptr);
+            free_tree(t);
+        }
+    }
+}
+
+TEST(C_LIST, ReviveWithNewKey)
+{
+    // A key that comes back in its own buffer replaces the erased one,
+    // which the caller is then free to release before compacting.
+    for (bool concurrent : {false, true}) {
+        tree *t = new_tree_for_keys(TREE_KEY_STRING, concurrent);
+        tree_set_lazy_delete(t, true);
+        char *first = strdup("key");
+        insert(t, first, first);
+        EXPECT_TRUE(tree_erase(t, first));
+        char *second = strdup("key");
+        insert(t, second, second);
+        free(first);
+        EXPECT_EQ(tree_compact(t, 100), 0u);
+        EXPECT_EQ(find(t, (void *) "key"), second);
+
+        // Erased and back again, then erased for good.
+        EXPECT_TRUE(tree_erase(t, second));
+        char *third = strdup("key");
+        insert(t, third, third);
+        free(second);
+        EXPECT_TRUE(tree_erase(t, third));
+        EXPECT_EQ(tree_compact(t, 100), 0u);
+        EXPECT_EQ(find(t, (void *) "key"), nullptr);
+        EXPECT_EQ(t->root, nullptr);
+        free(third);
+        free_tree(t);
+    }
+}
+
+TEST(C_LIST, OrderStatistics)
+{
+    std::vector<int64_t> keys(500);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = (int64_t) i * 2;
+    }
+    for (bool concurrent : {false, true}) {
+        for (bool lazy : {false, true}) {
+            tree *t = new_tree_for_keys(TREE_KEY_INT64, concurrent);
+            tree_set_lazy_delete(t, lazy);
+            // Turning it on with nodes already there counts them.
+            for (size_t i = 0; i < 50; ++i) {
+                insert(t, &keys[i], &keys[i]);
+            }
+            tree_enable_order_statistics(t);
+            std::map<int64_t, int64_t *> expected;
+            for (size_t i = 0; i < 50; ++i) {
+                expected[keys[i]] = &keys[i];
+            }
+            std::mt19937 rng(7 + lazy * 2 + concurrent);
+            for (int step = 0; step < 5000; ++step) {
+                int64_t *k = &keys[rng() % keys.size()];
+                if (rng() % 3 == 0) {
+                    tree_erase(t, k);
+                    expected.erase(*k);
+                } else {
+                    insert(t, k, k);
+                    expected[*k] = k;
+                }
+                if (step % 50 == 0) {
+                    tree_compact(t, 5);
+                }
+                if (step % 500 != 0) {
+                    continue;
+                }
+                ASSERT_EQ(tree_size(t), expected.size());
+                size_t i = 0;
+                for (auto &[key, value] : expected) {
+                    void *data = nullptr;
+                    EXPECT_EQ(tree_select(t, i, &data), value);
+                    EXPECT_EQ(data, value);
+                    EXPECT_EQ(tree_rank(t, &key), i);
+                    // Odd numbers are never in the tree.
+                    int64_t odd = key + 1;
+                    EXPECT_EQ(tree_rank(t, &odd), i + 1);
+                    i++;
+                }
+                EXPECT_EQ(tree_select(t, expected.size(), nullptr), nullptr);
+                int64_t lo = 100, hi = 301;
+                size_t in_range = std::distance(expected.lower_bound(lo), expected.upper_bound(hi));
+                EXPECT_EQ(tree_count_range(t, &lo, &hi), in_range);
+                EXPECT_EQ(tree_count_range(t, &hi, &lo), 0u);
+            }
+            free_tree(t);
+        }
+    }
+}
+
+TEST(C_LIST, HashIndex)
+{
+    std::vector<long> keys(1000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = (long) i;
+    }
+    for (int kind = 0; kind < 2; ++kind) {
+        for (bool lazy : {false, true}) {
+            tree *t = kind == 0 ? new_tree(intcmp) : new_int64_tree();
+            tree_set_lazy_delete(t, lazy);
+            for (size_t i = 0; i < 100; ++i) {
+                insert(t, &keys[i], &keys[i]);
+            }
+            ASSERT_TRUE(tree_enable_hash_index(t, kind == 0 ? low_bits_hash : NULL));
+            std::map<long, long *> expected;
+            for (size_t i = 0; i < 100; ++i) {
+                expected[keys[i]] = &keys[i];
+            }
+            std::mt19937 rng(kind * 2 + lazy);
+            for (int step = 0; step < 10000; ++step) {
+                long *k = &keys[rng() % keys.size()];
+                if (rng() % 3 == 0) {
+                    EXPECT_EQ(tree_erase(t, k), expected.erase(*k) == 1);
+                } else {
+                    insert(t, k, k);
+                    expected[*k] = k;
+                }
+                if (step % 20 == 0) {
+                    tree_compact(t, 3);
+                }
+            }
+            for (auto &k : keys) {
+                auto it = expected.find(k);
+                EXPECT_EQ(find(t, &k), it == expected.end() ? nullptr : it->second);
+                EXPECT_EQ(contains(t, &k), it != expected.end());
+            }
+            free_tree(t);
+        }
+    }
+
+    tree *strings = new_string_tree();
+    ASSERT_TRUE(tree_enable_hash_index(strings, NULL));
+    insert(strings, (void *) "garplay", (void *) "1");
+    insert(strings, (void *) "foo", (void *) "2");
+    EXPECT_STREQ((char *) find(strings, "garplay"), "1");
+    EXPECT_TRUE(tree_erase(strings, "garplay"));
+    EXPECT_FALSE(contains(strings, "garplay"));
+    EXPECT_STREQ((char *) find(strings, "foo"), "2");
+    free_tree(strings);
+
+    tree *concurrent = new_concurrent_tree(intcmp);
+    EXPECT_FALSE(tree_enable_hash_index(concurrent, low_bits_hash));
+    free_tree(concurrent);
+}
@@ -16,19 +16,49 @@
        the FILE pointer itself
 
    If there are no files specified it should simply exit.
+
+   With --head K before the file names, each file is streamed through
+   head_file instead and only its first K sorted lines are printed.  A
+   missing or malformed K also exits with code 42.
 */
 
 
 int main(int argc, char **argv) {
 
-  if (argc < 2){ 
+  int first = 1;
+  int head = 0;
+  size_t k = 0;
+  if (argc > 1 && strcmp(argv[1], "--head") == 0){
+    char *end;
+    if (argc < 3 || argv[2][0] == '\0' || argv[2][0] == '-'){
+      return 42;
+    }
+    k = strtoul(argv[2], &end, 10);
+    if (*end != '\0'){
+      return 42;
+    }
+    head = 1;
+    first = 3;
+  }
+  if (argc <= first){ 
     return 0; 
   }
-  for (int i=1; i < argc; i++ ){ //We need a for loop and i++ iterator to iterate within the arguments 
+  for (int i=first; i < argc; i++ ){ //We need a for loop and i++ iterator to iterate within the arguments 
     FILE *f = fopen(argv[i], "rb"); //We use this argument to open the file in a binary mode since one of the test cases is in binary 
     if (f == NULL){
       return 42; 
     }
+    if (head){
+      loaded_file *top = head_file(f, k);
+      if (!top){
+        fclose(f);
+        return 42;
+      }
+      print_file(top);
+      free_file(top);
+      fclose(f);
+      continue;
+    }
     loaded_file *file = load_file(f); //We need to load the file again 
     if (!file){ //If the file is empty then we close the file and return a random value to the user 
       fclose(f); 
@@ -35,78 +35,198 @@ int sorter_comp(const void *a, const void *b){
 /* You probably want to use qsort */
 void sort_file(loaded_file *f) 
 {
-  qsort(f->lines, f->num_lines, sizeof(line *),sorter_comp); 
+  if (f->num_lines > 1){ //qsort wants a real array even for zero lines, and an empty file has none
+    qsort(f->lines, f->num_lines, sizeof(line *),sorter_comp); 
+  }
+}
+
+
+/*
+ * Scratch space that read_line() grows as needed and reuses from line to
+ * line, so each line costs one exactly sized allocation for its data.
+ */
+typedef struct line_buffer_struct {
+  unsigned char *data;
+  size_t capacity;
+} line_buffer;
+
+/*
+ * Reads the next line (including its '\n', if it has one) from f into a
+ * freshly allocated line.  Returns 1 and sets *out when a line was read,
+ * 0 at end of file, and -1 if memory ran out.
+ */
+static int read_line(FILE *f, line_buffer *buf, line **out)
+{
+  size_t length = 0;
+  int character;
+  while ((character = fgetc(f)) != EOF){
+    if (length == buf->capacity){ //Grow by doubling so long lines don't realloc on every character
+      size_t new_capacity = buf->capacity ? buf->capacity * 2 : 128;
+      unsigned char *t_data = realloc(buf->data, new_capacity);
+      if (t_data == NULL){
+        return -1;
+      }
+      buf->data = t_data;
+      buf->capacity = new_capacity;
+    }
+    buf->data[length++] = (unsigned char)character;
+    if (character == '\n'){
+      break;
+    }
+  }
+  if (length == 0){ //Nothing left in the file
+    return 0;
+  }
+  line *current_line = malloc(sizeof(line));
+  if (current_line == NULL){
+    return -1;
+  }
+  current_line->data = malloc(length);
+  if (current_line->data == NULL){
+    free(current_line);
+    return -1;
+  }
+  memcpy(current_line->data, buf->data, length);
+  current_line->length = length;
+  *out = current_line;
+  return 1;
 }
 
+static void free_line(line *l)
+{
+  free(l->data);
+  free(l);
+}
 
 loaded_file *load_file(FILE*f)
 { 
   loaded_file*file = malloc(sizeof(loaded_file)); //We allocate the memory within the file here within the sizeof(loaded_file)
-    if (file == NULL) return NULL; //We check if teh file is null and return that to the user 
-
-    file -> lines = NULL; 
-    file -> num_lines = 0; //We want to set both as empty 
-    
-    line *current_line = malloc(sizeof(line)); //We allocate the memory once again 
-    if (current_line == NULL){//Check if the line is null and if so we have to free the file memory 
-      free(file); 
-      return NULL; 
-    }
-    current_line->data = NULL; //Next, we have to set everything to null 
-    current_line->length = 0; 
-    size_t current_size = 0; 
-
-    int character; //We create an int for character 
-    while ((character = fgetc(f))!= EOF){ //We use fgetc function so that we can read the file character by character until the END OF FILE
-      unsigned char *t_data = realloc(current_line ->data, current_size +1); //We have to adjust the memory storage here that's why current_size + 1 exists
-      if (t_data == NULL){ //Check if t_data is null and if so we have to free memory in current_line and the file 
-        free(current_line->data); 
-        free(current_line); 
+  if (file == NULL) return NULL; //We check if teh file is null and return that to the user 
+
+  file -> lines = NULL; 
+  file -> num_lines = 0; //We want to set both as empty 
+  size_t capacity = 0;
+
+  line_buffer buf = {NULL, 0};
+  line *current_line;
+  int status;
+  while ((status = read_line(f, &buf, &current_line)) > 0){
+    if (file->num_lines == capacity){
+      size_t new_capacity = capacity ? capacity * 2 : 16;
+      line **new_lines = realloc(file->lines, new_capacity * sizeof(line *));
+      if (!new_lines){ //If new lines is null then we have to free memory once again 
+        free_line(current_line);
+        free(buf.data);
         free_file(file);
         return NULL; 
       }
-      current_line->data = t_data; 
-      current_line->data[current_size++] = (unsigned char)character; 
-      
-      if (character== '\n'){ //IF chracter is a new line then we have to set length of current_line to current_size 
-        current_line->length = current_size; 
-        line **new_lines = realloc(file->lines, (file-> num_lines+1)*sizeof(line *)); //We reallocate the memory once again to adjust with the size 
-        if (!new_lines){ //If new lines is null then we have to free memory once again 
-          free(current_line->data); 
-          free(current_line); 
-          free_file(file);
-          return NULL; 
-        }
-        file->lines = new_lines; 
-        file->lines[file->num_lines++] = current_line; 
-        current_line = malloc(sizeof(line)); 
-        if (current_line == NULL){
-          free_file(file); 
-          return NULL; 
-        }
-        current_line->data = NULL; //Set all the data and length equal to null 
-        current_line->length = 0; 
-        current_size = 0; 
-      }
- }
-  if (current_size > 0){ //Next, we check if current_size > 0 and then adjust the size and memory accordingly 
-      current_line->length = current_size; 
-      line **new_lines = realloc(file->lines, (file->num_lines+1)* sizeof(line *));
-      if (!new_lines){ //If new_lines is null then we have to obviously free the memory once again 
-          free(current_line->data); 
-          free(current_line); 
-          free_file(file); 
-          return NULL; 
-      }
       file->lines = new_lines; 
-      file->lines[file->num_lines++] = current_line; //And we continue adjusting the current_line in case it does not match the conditions 
-  } else{
-      free(current_line->data); 
-      free(current_line); 
+      capacity = new_capacity;
+    }
+    file->lines[file->num_lines++] = current_line; 
+  }
+  free(buf.data);
+  if (status < 0){
+    free_file(file);
+    return NULL;
   }
-    
   return file; 
+}
 
+/*
+ * The lines are kept in a max-heap under sorter_comp, so lines[0] is the
+ * worst of the ones we are holding and the first to go when a better
+ * line turns up.
+ */
+static void heap_sift_up(line **heap, size_t i)
+{
+  while (i > 0){
+    size_t parent = (i - 1) / 2;
+    if (sorter_comp(&heap[parent], &heap[i]) >= 0){
+      break;
+    }
+    line *t = heap[parent];
+    heap[parent] = heap[i];
+    heap[i] = t;
+    i = parent;
+  }
+}
+
+static void heap_sift_down(line **heap, size_t n, size_t i)
+{
+  for (;;){
+    size_t largest = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+    if (left < n && sorter_comp(&heap[left], &heap[largest]) > 0){
+      largest = left;
+    }
+    if (right < n && sorter_comp(&heap[right], &heap[largest]) > 0){
+      largest = right;
+    }
+    if (largest == i){
+      return;
+    }
+    line *t = heap[largest];
+    heap[largest] = heap[i];
+    heap[i] = t;
+    i = largest;
+  }
+}
+
+/*
+ * Like load_file() followed by sort_file(), but only keeps the first k
+ * lines of the sorted order.  The input is streamed, so at most k + 1
+ * lines are in memory at once and the work is O(n log k).  Lines that
+ * compare equal under sorter_comp are byte-for-byte the same, so this
+ * prints exactly what the full sort would have printed first.
+ */
+loaded_file *head_file(FILE *f, size_t k)
+{
+  loaded_file *file = malloc(sizeof(loaded_file));
+  if (file == NULL) return NULL;
+  file->lines = NULL;
+  file->num_lines = 0;
+  if (k == 0){
+    return file;
+  }
+  size_t capacity = 0;
+
+  line_buffer buf = {NULL, 0};
+  line *current_line;
+  int status;
+  while ((status = read_line(f, &buf, &current_line)) > 0){
+    if (file->num_lines < k){
+      if (file->num_lines == capacity){ //Grow as lines arrive so a huge k on a small file costs nothing
+        size_t new_capacity = capacity ? capacity * 2 : 16;
+        if (new_capacity > k) new_capacity = k;
+        line **new_lines = realloc(file->lines, new_capacity * sizeof(line *));
+        if (new_lines == NULL){
+          free_line(current_line);
+          free(buf.data);
+          free_file(file);
+          return NULL;
+        }
+        file->lines = new_lines;
+        capacity = new_capacity;
+      }
+      file->lines[file->num_lines++] = current_line;
+      heap_sift_up(file->lines, file->num_lines - 1);
+    } else if (sorter_comp(&current_line, &file->lines[0]) < 0){
+      free_line(file->lines[0]);
+      file->lines[0] = current_line;
+      heap_sift_down(file->lines, file->num_lines, 0);
+    } else {
+      free_line(current_line);
+    }
+  }
+  free(buf.data);
+  if (status < 0){
+    free_file(file);
+    return NULL;
+  }
+  sort_file(file);
+  return file;
 }
 
 
@@ -1,5 +1,5 @@
 #ifndef _SORTER_H
-#define _SORTER
+#define _SORTER_H
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,6 +32,13 @@ void free_file(loaded_file *l);
 
 void sort_file(loaded_file *l);
 
+/*
+  Reads f a line at a time and returns only the first k lines of what
+  sort_file() would produce, already sorted.  Only holds k lines plus the
+  one being read, so the input can be far bigger than memory.
+*/
+loaded_file * head_file(FILE *f, size_t k);
+
 void print_file(loaded_file *l);
 
 
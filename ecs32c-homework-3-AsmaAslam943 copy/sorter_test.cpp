@@ -9,3 +9,73 @@ TEST(HelloTest, BasicAssertions) {
   // Expect equality.
   EXPECT_EQ(7 * 6, 42);
 }
+
+extern "C" {
+#include "sorter.h"
+}
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+// Writes contents to a temporary file and rewinds it for reading.
+static FILE *file_with(const std::string &contents) {
+  FILE *f = tmpfile();
+  fwrite(contents.data(), 1, contents.size(), f);
+  rewind(f);
+  return f;
+}
+
+static std::vector<std::string> lines_of(loaded_file *l) {
+  std::vector<std::string> out;
+  for (size_t i = 0; i < l->num_lines; i++) {
+    out.emplace_back((const char *)l->lines[i]->data, l->lines[i]->length);
+  }
+  return out;
+}
+
+static std::vector<std::string> sorted_lines(const std::string &contents) {
+  FILE *f = file_with(contents);
+  loaded_file *l = load_file(f);
+  sort_file(l);
+  std::vector<std::string> out = lines_of(l);
+  free_file(l);
+  fclose(f);
+  return out;
+}
+
+static std::vector<std::string> head_lines(const std::string &contents, size_t k) {
+  FILE *f = file_with(contents);
+  loaded_file *l = head_file(f, k);
+  std::vector<std::string> out = lines_of(l);
+  free_file(l);
+  fclose(f);
+  return out;
+}
+
+// head_file has to agree with the first k lines of the full sort, including
+// duplicates, embedded nulls, and a last line with no newline.
+TEST(SorterTest, HeadMatchesFullSort) {
+  std::mt19937 rng(32);
+  std::string contents;
+  for (int i = 0; i < 2000; i++) {
+    size_t length = rng() % 6;
+    for (size_t j = 0; j < length; j++) {
+      contents += (char)("ab\0c\xff"[rng() % 5]);
+    }
+    contents += '\n';
+  }
+  contents += "no newline";
+  std::vector<std::string> full = sorted_lines(contents);
+  ASSERT_EQ(full.size(), 2001u);
+  for (size_t k : {0, 1, 2, 7, 100, 2000, 2001, 5000}) {
+    std::vector<std::string> expected(full.begin(), full.begin() + std::min(k, full.size()));
+    EXPECT_EQ(head_lines(contents, k), expected) << "k = " << k;
+  }
+}
+
+TEST(SorterTest, HeadOfEmptyFile) {
+  EXPECT_TRUE(head_lines("", 3).empty());
+  EXPECT_EQ(head_lines("b\na\n", 1), std::vector<std::string>{"a\n"});
+}
@@ -1,6 +1,6 @@
 
 // We are going to build a binary search tree with an explicit
-// stack based iterator.  We are doing this as a "header-only"
+// iterator.  We are doing this as a "header-only"
 // c++ implementation, as it is templated and therefore needs
 // to be included to be used.  This provides basically the same
 // high level functionality as std::map, that is, a key/value
@@ -8,24 +8,237 @@
 
 // We need to include the following headers...
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
 #include <memory>
-#include <stack>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define HERE {std::cout << "IMPLEMENT HERE\n";}
 
+// The default ordering for tree keys: one three-way comparison,
+// a <=> b, whose result says less, equal or greater at once.  Keys
+// that only have < get the ordering built from it, which takes two.
+// A custom Compare is called the same way and returns anything that
+// compares against 0 like std::strong_ordering does.
+template <class K>
+struct BinaryTreeCompare
+{
+    template <class A, class B>
+    constexpr auto operator()(const A &a, const B &b) const
+    {
+        if constexpr (requires { a <=> b; }){
+            return a <=> b;
+        } else {
+            return a < b ? std::weak_ordering::less : b < a ? std::weak_ordering::greater : std::weak_ordering::equivalent;
+        }
+    }
+};
+
+// Integers subtract the two comparisons instead, which compiles to
+// flag reads and no branches, and a plain int is cheaper to test
+// against 0 than an ordering.
+template <std::integral K>
+struct BinaryTreeCompare<K>
+{
+    template <class A, class B>
+    constexpr int operator()(const A &a, const B &b) const
+    {
+        return (a > b) - (a < b);
+    }
+};
+
+// Which way rebalancing turned a subtree.  The double rotations
+// turn the taller child one way and then the node the other.
+enum class BinaryTreeRotation
+{
+    left,
+    right,
+    left_right,
+    right_left,
+};
+
+// What a BinaryTree reports its work to, its Policy.  This default
+// does nothing with it: every hook is empty and inline, and the
+// iterators carry no pointer back to it, so a tree with it compiles
+// to the same code as one with no hooks at all.
+struct BinaryTreeNoStats
+{
+    static constexpr bool enabled = false;
+
+    void compared()
+    {
+    }
+
+    void rotated(BinaryTreeRotation)
+    {
+    }
+
+    void allocated()
+    {
+    }
+
+    void stepped(int)
+    {
+    }
+};
+
+// A Policy that counts: key comparisons, rotations of each kind,
+// nodes allocated, and iterator steps with the links each one
+// followed.  The iterators have no stack, they walk parent links,
+// so links per step is what stands in for stack depth.  Counting
+// isn't atomic, so a tree with this policy shouldn't be read from
+// several threads at once, and its set operations run on the
+// calling thread only.
+struct BinaryTreeStats
+{
+    static constexpr bool enabled = true;
+
+    std::uint64_t comparisons = 0;
+    std::uint64_t rotations[4] = {};
+    std::uint64_t allocations = 0;
+    std::uint64_t iterator_steps = 0;
+    std::uint64_t iterator_links = 0;
+    int iterator_max_links = 0;
+
+    void compared()
+    {
+        comparisons++;
+    }
+
+    void rotated(BinaryTreeRotation kind)
+    {
+        rotations[int(kind)]++;
+    }
+
+    void allocated()
+    {
+        allocations++;
+    }
+
+    void stepped(int links)
+    {
+        iterator_steps++;
+        iterator_links += links;
+        iterator_max_links = std::max(iterator_max_links, links);
+    }
+
+    // The counters as a JSON object, along with depths, where
+    // depths[d] is how many nodes are d levels below the root.
+    std::string json(const std::vector<std::size_t> &depths) const
+    {
+        auto number = [](auto n) { return std::to_string(n); };
+        std::string out = "{\"comparisons\": " + number(comparisons);
+        out += ", \"rotations\": {\"left\": " + number(rotations[0]);
+        out += ", \"right\": " + number(rotations[1]);
+        out += ", \"left_right\": " + number(rotations[2]);
+        out += ", \"right_left\": " + number(rotations[3]) + "}";
+        out += ", \"allocations\": " + number(allocations);
+        out += ", \"iterator_steps\": " + number(iterator_steps);
+        out += ", \"iterator_links\": " + number(iterator_links);
+        out += ", \"iterator_max_links\": " + number(iterator_max_links);
+        out += ", \"height\": " + number(depths.size());
+        out += ", \"depths\": [";
+        for (std::size_t d = 0; d < depths.size(); ++d){
+            out += (d ? ", " : "") + number(depths[d]);
+        }
+        return out + "]}";
+    }
+};
+
+// The comparator a tree hands down to its nodes: its Compare, with
+// the Policy told about each comparison and rotation on the way.
+template <class Compare, class Policy>
+struct BinaryTreeOrder
+{
+    const Compare &compare;
+    Policy &policy;
+
+    template <class A, class B>
+    constexpr auto operator()(const A &a, const B &b) const
+    {
+        policy.compared();
+        return compare(a, b);
+    }
+
+    void rotated(BinaryTreeRotation kind) const
+    {
+        policy.rotated(kind);
+    }
+};
+
 // C++ require declaration before use, so we define
 // our three classes here.
-template <class K, class V>
+template <class K, class V, class Compare = BinaryTreeCompare<K>,
+          class Allocator = std::allocator<std::pair<const K, V>>, class Policy = BinaryTreeNoStats>
 class BinaryTree;
-template <class K, class V>
+template <class K, class V, bool IsConst = false, class Policy = BinaryTreeNoStats>
 class BinaryTreeIterator;
 template <class K, class V>
 class BinaryTreeNode;
+template <class K, class V>
+struct BinaryTreeLinks;
+template <class K, class V, class Allocator>
+class BinaryTreeNodeHandle;
+template <class K, class V, class Compare = BinaryTreeCompare<K>>
+class FrozenBinaryTree;
+template <class K, class V, class Compare = BinaryTreeCompare<K>>
+class ConcurrentBinaryTree;
+template <class K, class V, class Compare = BinaryTreeCompare<K>>
+class PersistentBinaryTree;
+
+// A type that can be looked up in a tree keyed by K without first
+// being turned into a K, e.g. std::string_view for std::string keys.
+template <class Q, class K, class Compare = BinaryTreeCompare<K>>
+concept LookupKey = requires(const Compare &compare, const Q &q, const K &k) {
+    { compare(q, k) < 0 } -> std::convertible_to<bool>;
+    { compare(k, q) < 0 } -> std::convertible_to<bool>;
+};
 
-// This iterator is returned for both start and
-// end but only the start iterator matters, the end 
-// iterator is effectively ignored.
+// The links every node has.  The tree also keeps one of these
+// with no entry as its header: the root hangs off header.left
+// with header as its parent, and header is the end() position.
+// Only the header has no parent.
+template <class K, class V>
+struct BinaryTreeLinks
+{
+    BinaryTreeLinks *parent = nullptr;
+    BinaryTreeNode<K, V> *left = nullptr;
+    BinaryTreeNode<K, V> *right = nullptr;
+};
+
+// The tree's iterator.  It walks the tree in order and
+// dereferences to the std::pair<const K, V> stored in the node,
+// so iterating never copies keys or values.  It is bidirectional,
+// and with IsConst set it is the tree's const_iterator.  Since
+// nodes know their parent it is just a pointer to the current
+// node; the walk needs no memory of its own.
 
 // It is considered "undefined behavior" (that is,
 // things are allowed to crash in obscure ways if)
@@ -38,394 +251,2804 @@ class BinaryTreeNode;
 // the data associated with keys using the iterator in a 
 // for loop, but it is not OK to
 // add new keys or remove keys)
-template <class K, class V>
-class BinaryTreeIterator : public std::input_iterator_tag
+//
+// With a counting Policy the iterator also holds the tree's policy
+// and tells it how many links each step followed.
+template <class K, class V, bool IsConst, class Policy>
+class BinaryTreeIterator
 {
-    friend class BinaryTree<K, V>;
+    template <class, class, class, class, class>
+    friend class BinaryTree;
+    friend class BinaryTreeIterator<K, V, !IsConst, Policy>;
 
-    // The constructor.  For end you don't actually
-    // need to do anything (the end is effectively a dummy).
-    // For the start iterator, you should set current to root
-    // and then call incr() so that the iterator is ready to 
-    // actually start the traversal
-    BinaryTreeIterator(BinaryTreeNode<K, V> *root, bool start)
+    explicit BinaryTreeIterator(BinaryTreeLinks<K, V> *node, Policy *policyin = nullptr) : current(node)
     {
-        current = root; //have to set current equal to root 
-        if (start){
-            incr(); //if start the increase 
-        } 
+        if constexpr (Policy::enabled){
+            policy = policyin;
+        }
     }
 
 public:
-    // This should return TRUE if there is still
-    // items left in the iteration:
-    // Basically, check to see if the stack is empty
-    // and current is null, and, if not, there is 
-    // still more work to do...
-    bool operator!=(BinaryTreeIterator<K, V> &other)
-    {
-        (void) other; //set (Void) other so that other is void 
-        if (current == nullptr && working_stack.empty()){
-            return false; //we have to return false if current is null and if the working_stack is empty 
-        } else{
-            return true; //otherwise return true 
-        }
+    using value_type = std::pair<const K, V>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::conditional_t<IsConst, const value_type &, value_type &>;
+    using pointer = std::conditional_t<IsConst, const value_type *, value_type *>;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    BinaryTreeIterator() : current(nullptr)
+    {
     }
 
-    // This is the heart of the tree traversal algorithm.
-    // It needs to be called once in the constructor and 
-    // once by each invocation of the ++ operator.
-    // The idea in english...
-    //
-    // While current is not null, push the current
-    // pointer onto the stack and take current->left 
-    // and make it the new current.
-    // 
-    // Once current is null, then take the top of the stack
-    // and set it to current...
-    void incr()
+    // Every iterator can be turned into a const_iterator.
+    template <bool OtherConst>
+        requires(IsConst && !OtherConst)
+    BinaryTreeIterator(const BinaryTreeIterator<K, V, OtherConst, Policy> &other)
+        : current(other.current)
     {
-        while (current != nullptr){ //when current is NOT equal to the nullpointer we have to push current node onto my working stack 
-            working_stack.push(current); 
-            current = current -> left; //update current to left 
-        }
-        if (!working_stack.empty()){ //if working_stack is not empty then set current equal to top 
-           current = working_stack.top(); 
-           working_stack.pop(); //and then pop it 
+        if constexpr (Policy::enabled){
+            policy = other.policy;
         }
-        else { //otherwise current is nullpointer 
-            current = nullptr; 
+    }
+
+    reference operator*() const
+    {
+        return static_cast<BinaryTreeNode<K, V> *>(current)->kv;
+    }
+
+    pointer operator->() const
+    {
+        return &static_cast<BinaryTreeNode<K, V> *>(current)->kv;
+    }
+
+    // Iterators are equal when they are on the same node.
+    template <bool OtherConst>
+    bool operator==(const BinaryTreeIterator<K, V, OtherConst, Policy> &other) const
+    {
+        return current == other.current;
+    }
+
+    // The in order successor: the leftmost node of the right
+    // subtree if there is one, otherwise the nearest ancestor
+    // that we are to the left of.  Past the largest key that
+    // ancestor is the header, which is end().
+    BinaryTreeIterator &operator++()
+    {
+        int links = 1;
+        if (current->right){
+            current = current->right;
+            while (current->left){
+                current = current->left;
+                links++;
+            }
+        } else {
+            BinaryTreeLinks<K, V> *up = current->parent;
+            while (current == up->right){
+                current = up;
+                up = up->parent;
+                links++;
+            }
+            current = up;
         }
+        stepped(links);
+        return *this;
+    }
+
+    BinaryTreeIterator operator++(int)
+    {
+        BinaryTreeIterator old = *this;
+        ++*this;
+        return old;
     }
 
-    // This should just call incr
-    void operator++()
+    // The mirror image of ++.  Stepping back from end()
+    // lands on the largest key.
+    BinaryTreeIterator &operator--()
     {
-        incr();
+        int links = 1;
+        if (current->parent == nullptr){
+            current = current->left;
+            while (current->right){
+                current = current->right;
+                links++;
+            }
+        } else if (current->left){
+            current = current->left;
+            while (current->right){
+                current = current->right;
+                links++;
+            }
+        } else {
+            BinaryTreeLinks<K, V> *up = current->parent;
+            while (current == up->left){
+                current = up;
+                up = up->parent;
+                links++;
+            }
+            current = up;
+        }
+        stepped(links);
+        return *this;
     }
 
-    // And this visits the node itself...
-    // In visiting the node, it should 
-    // both set current to be the current node's right
-    // and then return a pair constructed from the old 
-    // current node's key and value.
-    std::pair<K, V> operator*()
+    BinaryTreeIterator operator--(int)
     {
-        BinaryTreeNode<K,V>*tmp = current; 
-        current = current -> right; //continue to update current 
-        // This isn't actually what you want to return,
-        // its just a placeholder so the compiler doesn't complain.
-        return std::pair<K,V>(tmp->key, tmp->value);
+        BinaryTreeIterator old = *this;
+        --*this;
+        return old;
     }
 
 private:
-    // A pointer to the current node
-    BinaryTreeNode<K, V> *current;
+    void stepped([[maybe_unused]] int links)
+    {
+        if constexpr (Policy::enabled){
+            if (policy){
+                policy->stepped(links);
+            }
+        }
+    }
+
+    struct NoPolicy
+    {
+    };
 
-    // And a stack for the traversal visit of the tree
-    // nodes.
-    std::stack<BinaryTreeNode<K, V> *> working_stack;
+    // A pointer to the current node, the tree's header at the end.
+    BinaryTreeLinks<K, V> *current;
+    [[no_unique_address]] std::conditional_t<Policy::enabled, Policy *, NoPolicy> policy{};
 };
 
 
-// The class for the binary tree itself.
-template <class K, class V>
-class BinaryTree
+// Where a tree's nodes live.  Nodes are carved out of slabs taken
+// from the tree's allocator, and erased nodes go on a free list to
+// be reused, so the allocator is only called once per slab.  Every
+// slab is handed back when the pool goes away.
+template <class K, class V, class Allocator>
+class BinaryTreeNodePool
 {
+    using Node = BinaryTreeNode<K, V>;
+
+    // One node's worth of storage.  A free block holds the next
+    // free block, and the first block of each slab is the slab's
+    // header rather than a node.
+    union Block
+    {
+        Block *next_free;
+        struct
+        {
+            Block *next;
+            std::size_t count;
+        } slab;
+        alignas(Node) std::byte node[sizeof(Node)];
+    };
+    using BlockAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+    using BlockTraits = std::allocator_traits<BlockAllocator>;
+
+    static constexpr std::size_t FIRST_SLAB = 16;
+    static constexpr std::size_t MAX_SLAB = 4096;
+
 public:
-    BinaryTree() : root(nullptr)
+    explicit BinaryTreeNodePool(const Allocator &alloc) : blocks(alloc)
     {
     }
-    
-    // The [] operation is for both getting and setting.
-    // If the key exists in the tree a reference to the
-    // associated value is returned.  Otherwise, it will
-    // create a new tree node and return that value.
 
-    // What you should do is first check if the root is null
-    // and, if so, just create a new node.
-    // then simply invoke root->find(key) and return
-    // that value as find is already set up to return
-    // a reference.
-    V &operator[](const K &key)
+    BinaryTreeNodePool(const BinaryTreeNodePool &) = delete;
+    BinaryTreeNodePool &operator=(const BinaryTreeNodePool &) = delete;
+
+    ~BinaryTreeNodePool()
+    {
+        release();
+    }
+
+    Allocator get_allocator() const
+    {
+        return Allocator(blocks);
+    }
+
+    // A new node built from args.
+    template <class... Args>
+    Node *make(Args &&...args)
     {
-        if (root == nullptr){ //We need to check if the root is null 
-            root = new BinaryTreeNode<K, V>(key);  
+        Block *block = take();
+        try {
+            return ::new (static_cast<void *>(block->node)) Node(std::forward<Args>(args)...);
+        } catch (...) {
+            give_back(block);
+            throw;
         }
-        // THis is just to keep the compiler happy
-        // so your code compiles, this is not what you
-        // actually want to return
-        return root->find(key); //this returns the root's value key if it is NOT null 
     }
 
-    // This should return false if the tree
-    // is empty, otherwise return root->contains
-    bool contains(const K &key)
+    void destroy(Node *node)
+    {
+        node->~Node();
+        give_back(reinterpret_cast<Block *>(node));
+    }
+
+    // True if node sits in one of this pool's slabs.
+    bool owns(const Node *node) const
     {
-        if (root == nullptr){
-            return false; //since it's empty returns false 
+        auto address = reinterpret_cast<const Block *>(node);
+        for (Block *slab = slabs; slab; slab = slab->slab.next){
+            if (address > slab && address < slab + slab->slab.count){
+                return true;
+            }
         }
-        return root->contains(key); //otherwise it returns root->contains key 
+        return false;
     }
 
-    // Erases a node if a key matches.  If the
-    // key does not match it simply is an operation
-    // that does nothing.
-    void erase(const K &key)
+    // Hands every slab back to the allocator.  Nodes still in them
+    // are not destroyed, so the caller must have done that already
+    // or know that there is nothing to do.
+    void release()
     {
-        if (root == nullptr){ //if root is equal to nullptr simply return 
-            return;
-        } else{ //but if we have smthng in then we have to call on erase(key)
-            root = root->erase(key); //otherwise we call erase on it
+        while (slabs){
+            Block *next = slabs->slab.next;
+            BlockTraits::deallocate(blocks, slabs, slabs->slab.count);
+            slabs = next;
         }
+        free_list = nullptr;
+        slab_size = FIRST_SLAB;
     }
 
-    // And the destructor for the binary tree.
-    // In order to prevent memory leaks and keep with
-    // the C++ "RAII" convention, it should see
-    // if there is a root and, if so, call freetree()
-    // on the root.
-    ~BinaryTree()
+private:
+    Block *take()
     {
-        if (root != nullptr){
-            root-> freetree(); //we have to call on freetree to delete all nodes  
+        if (free_list == nullptr){
+            grow();
         }
-        root = nullptr; //set root to nullptr 
-    
+        Block *block = free_list;
+        free_list = block->next_free;
+        return block;
     }
 
-    // This returns the iterators.
-    BinaryTreeIterator<K, V> begin()
+    void give_back(Block *block)
     {
-        return BinaryTreeIterator(root, true);
+        block->next_free = free_list;
+        free_list = block;
     }
-    BinaryTreeIterator<K, V> end()
+
+    // Adds a slab, each one twice the last up to MAX_SLAB blocks.
+    void grow()
     {
-        return BinaryTreeIterator(root, false);
+        Block *slab = BlockTraits::allocate(blocks, slab_size);
+        slab->slab.next = slabs;
+        slab->slab.count = slab_size;
+        slabs = slab;
+        for (std::size_t i = slab_size - 1; i > 0; --i){
+            give_back(&slab[i]);
+        }
+        slab_size = std::min(slab_size * 2, MAX_SLAB);
     }
 
-protected:
-    BinaryTreeNode<K, V> *root;
+    BlockAllocator blocks;
+    Block *slabs = nullptr;
+    Block *free_list = nullptr;
+    std::size_t slab_size = FIRST_SLAB;
 };
 
-// And the class for the binary tree node itself.
-template <class K, class V>
-class BinaryTreeNode
+
+// An entry taken out of a tree with extract(), still in its node.
+// It can be put into any tree with the same K and V through
+// insert() without copying or reallocating it.  The handle keeps
+// the pool the node came from alive, and if it is dropped without
+// being inserted the entry is destroyed.
+template <class K, class V, class Allocator>
+class BinaryTreeNodeHandle
 {
-    friend class BinaryTree<K, V>;
-    friend class BinaryTreeIterator<K, V>;
+    template <class, class, class, class, class>
+    friend class BinaryTree;
 
-public:
-    // The constructor, it simply setts the key and the left/right pointers.
-    // Data defaults to whatever the default value is for the data type.
-    BinaryTreeNode(const K &keyin) : key(keyin), left(nullptr), right(nullptr), height(1) //set height to 1 
+    using Node = BinaryTreeNode<K, V>;
+    using Pool = BinaryTreeNodePool<K, V, Allocator>;
+
+    BinaryTreeNodeHandle(Node *nodein, std::shared_ptr<Pool> poolin)
+        : node(nodein), pool(std::move(poolin))
     {
     }
 
-    // This should recursively free the tree.
-    // It should call freetree on left and 
-    // right and then, as the last act,
-    // call delete on this.  
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using allocator_type = Allocator;
 
-    // Yes, you can "suicide" an object in C++,
-    // and this is a case where you want to do it.
-    void freetree()
+    BinaryTreeNodeHandle() = default;
+
+    BinaryTreeNodeHandle(BinaryTreeNodeHandle &&other) noexcept
+        : node(std::exchange(other.node, nullptr)), pool(std::move(other.pool))
     {
-        if (left){ //if left does exxist then free and same for right 
-            left ->freetree(); 
-        }
-        if (right){
-            right->freetree();
+    }
+
+    BinaryTreeNodeHandle &operator=(BinaryTreeNodeHandle &&other) noexcept
+    {
+        if (this != &other){
+            reset();
+            node = std::exchange(other.node, nullptr);
+            pool = std::move(other.pool);
         }
-        delete this; //then delete this 
+        return *this;
     }
 
-protected:
+    ~BinaryTreeNodeHandle()
+    {
+        reset();
+    }
 
-    // Removing a node from a binary tree, returning
-    // a pointer to the now modified tree.
+    bool empty() const
+    {
+        return node == nullptr;
+    }
 
-    // If you aren't at the node you are looking for, just set
-    // your new left or right pointer (as approriate, and if it exists) 
-    // to the  result of recursively calling erase, and then return this.
+    explicit operator bool() const
+    {
+        return node != nullptr;
+    }
 
-    // If this node does match the key however, check the
-    // child nodes.  If there is no left, assign the right node to a temporary
-    // value, delete this, and return the right node.
-    // If there is no right node, do the same thing.
-    // If there is both a left and right node, check if the left node
-    // doesn't have a right node of its own.  If so, set that node's right
-    // to the current right, assign left to a temporary, and delete this and
-    // return that left node.
+    const K &key() const
+    {
+        return node->kv.first;
+    }
 
-    // Finally, if the left node DOES have a right node, keep
-    // following the right hand side of that subtree until you
-    // find a node without a right hand branch.  In that case set
-    // the node above it's right to that node's left, assign that
-    // node to a temporary, have its left point to the current node's left
-    // its right to the current node's right, delete this and return that
-    // node.
-    BinaryTreeNode<K, V> *erase(const K &k)
+    V &mapped() const
     {
-        if (k < key){ //if k < key then make sure left = left->erase(k )
-            if (left){
-                left = left ->erase(k); 
-            }
-        }
-        else if (k > key){
-            if (right){ //if right then make sure right = right->erase(k)
-                right = right->erase(k); 
-            }
+        return node->kv.second;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return pool->get_allocator();
+    }
+
+private:
+    void reset()
+    {
+        if (node){
+            pool->destroy(node);
+            node = nullptr;
         }
-        else {
-            if (!left){
-                auto temp = right; 
-                delete this; 
-                return temp; //if left is null make sure auto temp is set to right and delete current node 
+        pool.reset();
+    }
 
-            }
-            if (!right){ //if right is null then set to left and delete current node so it returns the temporary 
-                auto temp = left; 
-                delete this; 
-                return temp; 
-            }
+    Node *node = nullptr;
+    std::shared_ptr<Pool> pool;
+};
 
-            BinaryTreeNode<K,V>*temp = left; 
-            if (!temp->right){ //if its not null then make sure temp->right is set to right 
-                temp ->right = right; 
-                delete this; 
-                return temp; 
-            }
 
-            while (temp ->right ->right){ //make sure temp->right->right then temp = temp->right 
-                temp = temp->right; 
-            }
+// How save() and load() write and read one key or value.  tag goes
+// in the file header, so a file is only loaded into a tree with the
+// same key and value types.  Types without a codec can't be saved.
+template <class T>
+struct BinaryTreeCodec;
 
-            BinaryTreeNode<K,V>*previous = temp ->right; //set a previous node 
-            temp ->right = previous ->left; //set temporary to right and previous to left 
-            previous->left = left; 
-            previous ->right = right; 
+// Numbers and enums go as their bytes.  The tag is their size and
+// whether they are signed, unsigned or floating point (or an enum),
+// so an int64_t file doesn't load as doubles.  Other trivially
+// copyable types aren't taken on trust: a pointer's bytes are an
+// address in this process, a struct's padding is garbage, and a size
+// alone can't tell two structs apart.  They need a specialization of
+// their own.
+template <class T>
+    requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+struct BinaryTreeCodec<T>
+{
+    static constexpr std::uint32_t tag = sizeof(T) | (std::is_floating_point_v<T> ? 3u << 16
+                                                      : std::is_signed_v<T>      ? 1u << 16
+                                                      : std::is_unsigned_v<T>    ? 2u << 16
+                                                                                 : 0u);
 
-            delete this; 
-            return previous; //return previous 
-        }
-        // Again, not what you will always want to return...
-        return rebalance(); //to pass the performance test we need an O(nlogn) complexity so we need to call the function at the bottom 
+    static void write(std::string &out, const T &value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
     }
 
-    // This seeks to recursively find a key, creating
-    // a new node if necessary.
-    // If k == this node's key, return the value.
-    // If k < this key it is to the left.
-    // If there is no left node, create it with k as the key.
-    // Then recursively return find on the left.  Similar for
-    // the right. 
-    V &find(const K &k)
+    static std::optional<T> read(const char *&at, const char *end)
     {
-        if (k == key){ //if k == key then return the right value 
-            return value; 
+        if (std::size_t(end - at) < sizeof(T)){
+            return std::nullopt;
         }
-        if (k < key){
-            if (!left){ //if left is null then we need to create a left = new BinaryTreeNode(K)
-                left = new BinaryTreeNode(k); //couldn't use <K,V> so I used (k) instead 
-            }
-            left = left->rebalance(); //again call rebalance to maintain O(nlogn)
-            return left->find(k); //lastly find 
-        }
-        if (!right){
-            right = new BinaryTreeNode(k); 
+        T value;
+        std::memcpy(&value, at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+};
+
+// A bool goes as one byte, 0 or 1.  Copying any other byte into a
+// bool is undefined, so read turns it away like any other bad data.
+template <>
+struct BinaryTreeCodec<bool>
+{
+    static constexpr std::uint32_t tag = 4u << 16 | 1u;
+
+    static void write(std::string &out, bool value)
+    {
+        out.push_back(value ? 1 : 0);
+    }
+
+    static std::optional<bool> read(const char *&at, const char *end)
+    {
+        if (at == end || (unsigned char) *at > 1){
+            return std::nullopt;
         }
-        right = right->rebalance(); //rebalance and then returns updated right 
-        return right->find(k); 
-        // THis is just to keep the compiler happy
-        // so your code compiles, this is not what you
-        // actually want to return
+        return *at++ == 1;
     }
+};
+
+// Strings go as their length in 7 bit groups, low first with the
+// top bit set on all but the last, then their characters, so most
+// lengths take one byte.
+template <class CharT, class Traits, class Alloc>
+struct BinaryTreeCodec<std::basic_string<CharT, Traits, Alloc>>
+{
+    using String = std::basic_string<CharT, Traits, Alloc>;
+
+    static constexpr std::uint32_t tag = 0x80000000u | sizeof(CharT);
 
-    // And contains is a recursive search that doesn't
-    // create new nodes, just checks if the key exists.
-    bool contains(const K &k)
+    static void write(std::string &out, const String &value)
     {
-        if (k == key){ //if k == key then u have to return true 
-            return true; 
+        std::uint64_t length = value.size();
+        while (length >= 0x80){
+            out.push_back(char(length | 0x80));
+            length >>= 7;
         }
-        if (k<key && left){ //ptherwise check if they exist 
-            return left->contains(k);  
+        out.push_back(char(length));
+        out.append(reinterpret_cast<const char *>(value.data()), value.size() * sizeof(CharT));
+    }
+
+    static std::optional<String> read(const char *&at, const char *end)
+    {
+        std::uint64_t length = 0;
+        for (int shift = 0;; shift += 7){
+            if (at == end || shift > 56){
+                return std::nullopt;
+            }
+            unsigned char byte = *at++;
+            length |= std::uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)){
+                break;
+            }
         }
-        if (k>key && right){
-            return right ->contains(k); 
+        if (length > std::size_t(end - at) / sizeof(CharT)){
+            return std::nullopt;
         }
-        return false; //this means no key is here 
-        
+        String value(length, CharT());
+        std::memcpy(value.data(), at, length * sizeof(CharT));
+        at += length * sizeof(CharT);
+        return value;
     }
-protected: 
-    K key;
-    V value;
-    BinaryTreeNode<K, V> *left;
-    BinaryTreeNode<K, V> *right;
+};
 
-    int height; 
+// The layout save() writes, in the machine's byte order:
+//
+//   magic     8 bytes, "BTREE" and three zeros
+//   version   u32, FORMAT_VERSION
+//   key tag   u32, the key codec's tag
+//   value tag u32, the value codec's tag
+//   reserved  u32, 0
+//   count     u64, number of entries
+//   length    u64, bytes of entries
+//   checksum  u64, BinaryTreeFile::checksum of the entries
+//
+// and then count key, value pairs in key order.
+struct BinaryTreeFile
+{
+    static constexpr char MAGIC[8] = {'B', 'T', 'R', 'E', 'E', 0, 0, 0};
+    static constexpr std::uint32_t FORMAT_VERSION = 1;
 
-    int getHeight(BinaryTreeNode*node){
-        if (node == nullptr){ //using lecture 24 slides. if node is null then it just returns 0 otherwise node->height 
-            return 0; 
-        } else{
-            return node->height; 
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t key_tag;
+        std::uint32_t value_tag;
+        std::uint32_t reserved;
+        std::uint64_t count;
+        std::uint64_t length;
+        std::uint64_t checksum;
+    };
+
+    // FNV-1a a word rather than a byte at a time, then the bytes
+    // left over.  Multiplying only carries changes upwards, so on its
+    // own a flip of bit 63 in one word would cancel one in another;
+    // folding the high half down after each word stops that.
+    // Carrying seed from one call to the next gives the same answer
+    // as one call as long as every call but the last covers a
+    // multiple of 8 bytes.
+    static std::uint64_t checksum(const char *data, std::size_t n, std::uint64_t seed = 0xcbf29ce484222325u)
+    {
+        const std::uint64_t prime = 0x100000001b3u;
+        std::uint64_t h = seed;
+        for (; n >= 8; data += 8, n -= 8){
+            std::uint64_t word;
+            std::memcpy(&word, data, 8);
+            h = (h ^ word) * prime;
+            h ^= h >> 29;
         }
+        for (; n > 0; ++data, --n){
+            h = (h ^ (unsigned char) *data) * prime;
+        }
+        return h;
     }
-    
-    void updateHeight(){
-        height = 1 + std::max(getHeight(left),getHeight(right)); //we need to find the max of getHeight(left), getHeight(right)
-    } 
 
-    int balance(){ //return the balance by getting difference of right and left 
-        return getHeight(right)- getHeight(left); 
-    }
+    // A whole file, read only.  Where there is mmap the pages are
+    // mapped rather than copied, and only read in as they are used.
+    class View
+    {
+    public:
+        explicit View(const std::filesystem::path &path)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0){
+                return;
+            }
+            struct stat info;
+            if (::fstat(fd, &info) == 0 && info.st_size > 0){
+                void *mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED){
+                    bytes = static_cast<const char *>(mapped);
+                    size = info.st_size;
+                    ::madvise(mapped, size, MADV_SEQUENTIAL);
+                }
+            }
+            ::close(fd);
+#else
+            std::ifstream in(path, std::ios::binary);
+            copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            bytes = copy.data();
+            size = copy.size();
+#endif
+        }
+
+        View(const View &) = delete;
+        View &operator=(const View &) = delete;
+
+        ~View()
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (bytes){
+                ::munmap(const_cast<char *>(bytes), size);
+            }
+#endif
+        }
+
+        const char *bytes = nullptr;
+        std::size_t size = 0;
+
+    private:
+#if !defined(__unix__) && !defined(__APPLE__)
+        std::vector<char> copy;
+#endif
+    };
+};
+
+// The class for the binary tree itself.  Keys are ordered by
+// Compare, see BinaryTreeCompare, and nodes come from a pool that
+// gets its memory from Allocator.
+template <class K, class V, class Compare, class Allocator, class Policy>
+class BinaryTree
+{
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using iterator = BinaryTreeIterator<K, V, false, Policy>;
+    using const_iterator = BinaryTreeIterator<K, V, true, Policy>;
+    using node_type = BinaryTreeNodeHandle<K, V, Allocator>;
+
+    // What insert(node_type) hands back: where the key is, whether
+    // the node went in, and the node again if it didn't.
+    struct insert_return_type
+    {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    BinaryTree() : BinaryTree(Allocator())
+    {
+    }
+
+    explicit BinaryTree(const Allocator &allocin) : alloc(allocin)
+    {
+    }
+
+    explicit BinaryTree(const Compare &comparein, const Allocator &allocin = Allocator())
+        : compare(comparein), alloc(allocin)
+    {
+    }
+
+    // Builds the tree from entries in key order in O(n), balanced
+    // from the start rather than by n inserts.  An unsorted range
+    // works too, from the first key out of order on it goes in one
+    // entry at a time.  Repeats of a key after the first are dropped.
+    template <std::input_iterator It>
+    BinaryTree(It first, It last, const Compare &comparein = Compare(), const Allocator &allocin = Allocator())
+        : compare(comparein), alloc(allocin)
+    {
+        std::vector<BinaryTreeNode<K, V> *> sorted;
+        try {
+            for (; first != last; ++first){
+                BinaryTreeNode<K, V> *node = make_node(std::in_place, *first);
+                if (sorted.empty()){
+                    sorted.push_back(node);
+                    continue;
+                }
+                auto order = this->order()(sorted.back()->kv.first, node->kv.first);
+                if (order < 0){
+                    sorted.push_back(node);
+                } else if (order > 0){
+                    set_root(BinaryTreeNode<K, V>::build(sorted.data(), sorted.size()));
+                    sorted.clear();
+                    if (!place(node->kv.first, [&] { return node; }).second){
+                        pool->destroy(node);
+                    }
+                    for (++first; first != last; ++first){
+                        emplace(*first);
+                    }
+                    return;
+                } else {
+                    pool->destroy(node);
+                }
+            }
+        } catch (...) {
+            for (auto node : sorted){
+                pool->destroy(node);
+            }
+            clear();
+            throw;
+        }
+        set_root(BinaryTreeNode<K, V>::build(sorted.data(), sorted.size()));
+    }
 
+    // Copies are node for node, so the copy has the same shape
+    // and needs no rebalancing.
+    BinaryTree(const BinaryTree &other)
+        : BinaryTree(other, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.alloc))
+    {
+    }
+
+    BinaryTree(const BinaryTree &other, const Allocator &allocin) : compare(other.compare), alloc(allocin)
+    {
+        if (other.root()){
+            NodeMaker maker{*this};
+            set_root(other.root()->clone(maker));
+        }
+    }
+
+    // Moving hands over the nodes and the pool they live in;
+    // other is left empty but usable.
+    BinaryTree(BinaryTree &&other) noexcept : compare(other.compare), alloc(other.alloc)
+    {
+        take(other);
+    }
+
+    BinaryTree &operator=(const BinaryTree &other)
+    {
+        if (this != &other){
+            *this = BinaryTree(other, alloc);
+        }
+        return *this;
+    }
+
+    // With an allocator that doesn't move along and doesn't
+    // compare equal the nodes can't change hands, so the
+    // entries are moved over one at a time instead.
+    BinaryTree &operator=(BinaryTree &&other) noexcept(
+        std::allocator_traits<Allocator>::is_always_equal::value ||
+        std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value)
+    {
+        if (this == &other){
+            return *this;
+        }
+        clear();
+        compare = other.compare;
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value){
+            alloc = other.alloc;
+        }
+        if (alloc == other.alloc){
+            take(other);
+        } else {
+            for (auto &[key, value] : other){
+                try_emplace(key, std::move(value));
+            }
+            other.clear();
+        }
+        return *this;
+    }
+
+    void swap(BinaryTree &other) noexcept
+    {
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value){
+            std::swap(alloc, other.alloc);
+        }
+        std::swap(compare, other.compare);
+        std::swap(pool, other.pool);
+        std::swap(lenders, other.lenders);
+        BinaryTreeNode<K, V> *mine = root();
+        set_root(other.root());
+        other.set_root(mine);
+    }
+
+    allocator_type get_allocator() const
+    {
+        return alloc;
+    }
+
+    key_compare key_comp() const
+    {
+        return compare;
+    }
     
-    BinaryTreeNode<K,V>*rotateleft(){
-        BinaryTreeNode<K,V>*top = right; //we have to make sure to rotate left that we first grab the top  
-        right = top ->left; 
-        top -> left = this; //once right = top->left then "this" is updated to top->left 
-        this -> updateHeight(); 
-        top->updateHeight(); 
+    // The [] operation is for both getting and setting.
+    // If the key exists in the tree a reference to the
+    // associated value is returned.  Otherwise, it will
+    // create a new tree node and return that value.
 
-        return top; 
+    // place() walks down once, and either finds the key or hangs
+    // the new node where the walk ran out.
+    V &operator[](const K &key)
+    {
+        return place(key, [&] { return make_node(key); }).first->second;
     }
 
-    BinaryTreeNode<K,V>*rotateright(){
-        BinaryTreeNode<K,V>*top = left; //create node*top such that its named left 
-        left = top ->right; //set left equal to top->right 
-        top ->right = this; //and set top->right equal to this 
+    // Adds key with a value built from args, unless key is already
+    // there, in which case nothing is built or moved from.
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+    {
+        return place(key, [&] {
+            return make_node(std::in_place, std::piecewise_construct, std::forward_as_tuple(key),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+    }
 
-        this -> updateHeight(); //ask this to continue updating the height and do same for top 
-        top ->updateHeight(); 
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        return place(key, [&] {
+            return make_node(std::in_place, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+    }
 
-        return top; //return top to rotate right 
+    // Builds the entry from args first, so the key can come from
+    // anything a std::pair<const K, V> can be made from.  If the
+    // key was already there the new entry is thrown away.
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        BinaryTreeNode<K, V> *node = make_node(std::in_place, std::forward<Args>(args)...);
+        auto placed = place(node->kv.first, [&] { return node; });
+        if (!placed.second){
+            pool->destroy(node);
+        }
+        return placed;
     }
 
-    BinaryTreeNode<K,V>*rebalance(){
-        updateHeight(); //call on updateheight void 
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&value)
+    {
+        auto placed = try_emplace(key, std::forward<M>(value));
+        if (!placed.second){
+            placed.first->second = std::forward<M>(value);
+        }
+        return placed;
+    }
 
-        int node_bal = balance(); //grab the balance again 
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&value)
+    {
+        auto placed = try_emplace(std::move(key), std::forward<M>(value));
+        if (!placed.second){
+            placed.first->second = std::forward<M>(value);
+        }
+        return placed;
+    }
 
-        if (node_bal == 2){ //using lecture 24 pseudocode i found if the node balance is equal to 2 (right heavy) then 
-            if (right && right->balance()< 0 ){
-                right = right ->rotateright(); //we have to update right so right=right->rotateright()
+    // Unlinks the entry for key and hands it over in its node.
+    // The handle is empty if key isn't there.
+    node_type extract(const K &key)
+    {
+        BinaryTreeNode<K, V> *taken = nullptr;
+        if (root()){
+            set_root(root()->erase(key, order(), [&](BinaryTreeNode<K, V> *node) { taken = node; }));
+        }
+        if (taken == nullptr){
+            return node_type();
+        }
+        taken->parent = nullptr;
+        taken->left = nullptr;
+        taken->right = nullptr;
+        taken->height = 1;
+        return node_type(taken, owner_of(taken));
+    }
+
+    node_type extract(const_iterator position)
+    {
+        return extract(position->first);
+    }
+
+    // Links in a node from extract(), from this tree or another.
+    // If its key is already here the handle is given back.
+    insert_return_type insert(node_type &&handle)
+    {
+        if (handle.empty()){
+            return {end(), false, node_type()};
+        }
+        BinaryTreeNode<K, V> *node = handle.node;
+        auto placed = place(node->kv.first, [&] { return node; });
+        if (!placed.second){
+            return {placed.first, false, std::move(handle)};
+        }
+        // The node stays in the other pool's slab, so that pool has
+        // to live as long as this tree does.
+        lend(handle.pool);
+        handle.node = nullptr;
+        handle.pool.reset();
+        return {placed.first, true, node_type()};
+    }
+
+    // The set operations join whole subtrees rather than inserting
+    // one key at a time, so for trees of m <= n entries they take
+    // O(m log(n/m + 1)).  other's nodes are taken over, not copied;
+    // pass a copy to keep it.  Where both trees are big the work is
+    // split over up to threads threads, unless Policy is counting.
+
+    // Adds the entries of other whose keys aren't here yet.
+    void unite(BinaryTree other, unsigned threads = std::thread::hardware_concurrency())
+    {
+        combine(other, threads, [&](auto a, auto b, auto &dropped, int forks) {
+            return BinaryTreeNode<K, V>::unite(a, b, dropped, forks, order());
+        });
+    }
+
+    // Keeps only the keys other has as well.
+    void intersect(BinaryTree other, unsigned threads = std::thread::hardware_concurrency())
+    {
+        combine(other, threads, [&](auto a, auto b, auto &dropped, int forks) {
+            return BinaryTreeNode<K, V>::intersect(a, b, dropped, forks, order());
+        });
+    }
+
+    // Removes the keys other has.
+    void subtract(BinaryTree other, unsigned threads = std::thread::hardware_concurrency())
+    {
+        combine(other, threads, [&](auto a, auto b, auto &dropped, int forks) {
+            return BinaryTreeNode<K, V>::subtract(a, b, dropped, forks, order());
+        });
+    }
+
+    // Moves every key from key up into a new tree, in O(log n).
+    BinaryTree split(const K &key)
+    {
+        BinaryTree upper(compare, alloc);
+        if (root() == nullptr){
+            return upper;
+        }
+        auto s = BinaryTreeNode<K, V>::split(root(), key, order());
+        set_root(s.less);
+        if (s.match){
+            s.match->left = nullptr;
+            s.match->right = nullptr;
+            s.greater = BinaryTreeNode<K, V>::join(nullptr, s.match, s.greater, order());
+        }
+        upper.set_root(s.greater);
+        if (upper.root()){
+            // The nodes stay where they are, in this tree's pools.
+            for (auto &lender : lenders){
+                upper.lend(lender);
             }
-            return rotateleft(); //tehn we rotateleft because the right is much heavier 
+            upper.lend(pool);
         }
-        if (node_bal == -2){ //if the left side is heavy hence more negative then we rotate right 
-            if (left && left->balance()> 0){ //but if the balance is greater than 0
-                left = left ->rotateleft(); //rotate left 
+        return upper;
+    }
+
+    // Returns a pointer to the value for key, or nullptr if it
+    // isn't there.  Unlike [], this never adds a node or rebalances.
+    // key may be anything that compares with K, so a std::string_view
+    // can be looked up in a tree of std::string without a copy.
+    template <LookupKey<K, Compare> Q>
+    V *find(const Q &key)
+    {
+        auto node = lookup(key);
+        return node ? &node->kv.second : nullptr;
+    }
+
+    template <LookupKey<K, Compare> Q>
+    const V *find(const Q &key) const
+    {
+        auto node = lookup(key);
+        return node ? &node->kv.second : nullptr;
+    }
+
+    // True if the key is in the tree.
+    template <LookupKey<K, Compare> Q>
+    bool contains(const Q &key) const
+    {
+        return lookup(key) != nullptr;
+    }
+
+    // Erases a node if a key matches.  If the
+    // key does not match it simply is an operation
+    // that does nothing.
+    void erase(const K &key)
+    {
+        if (root() == nullptr){ //if root is equal to nullptr simply return 
+            return;
+        } else{ //but if we have smthng in then we have to call on erase(key)
+            set_root(root()->erase(key, order(), [&](BinaryTreeNode<K, V> *node) { nodes().destroy(node); })); //otherwise we call erase on it
+        }
+    }
+
+    // Erases the entry at position and returns the one after it.
+    iterator erase(const_iterator position)
+    {
+        return erase(position, std::next(position));
+    }
+
+    // Erases [first, last) and returns last.  The tree is split
+    // around the range and the two sides joined back, so besides
+    // freeing the erased nodes this costs O(log n) however many
+    // there are.
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        if (first == last){
+            return iterator(last.current, &policy);
+        }
+        auto drop = [&](BinaryTreeNode<K, V> *node) { nodes().destroy(node); };
+        auto low = BinaryTreeNode<K, V>::split(root(), first->first, order());
+        low.match->left = nullptr;
+        low.match->right = nullptr;
+        low.match->freetree(drop);
+        if (last == end()){
+            if (low.greater){
+                low.greater->freetree(drop);
             }
-            return rotateright(); //since we're left heavy we will rotate right 
+            set_root(low.less);
+            return end();
         }
+        auto high = BinaryTreeNode<K, V>::split(low.greater, last->first, order());
+        if (high.less){
+            high.less->freetree(drop);
+        }
+        set_root(BinaryTreeNode<K, V>::join(low.less, high.match, high.greater, order()));
+        return iterator(high.match, &policy);
+    }
 
-        return this; 
+    // The first entry whose key is not less than key, or end().
+    template <LookupKey<K, Compare> Q>
+    iterator lower_bound(const Q &key)
+    {
+        return iterator(bound(key, [&](const Q &q, const K &k) { return order()(k, q) >= 0; }), &policy);
+    }
+
+    template <LookupKey<K, Compare> Q>
+    const_iterator lower_bound(const Q &key) const
+    {
+        return const_iterator(bound(key, [&](const Q &q, const K &k) { return order()(k, q) >= 0; }), &policy);
+    }
+
+    // The first entry whose key is greater than key, or end().
+    template <LookupKey<K, Compare> Q>
+    iterator upper_bound(const Q &key)
+    {
+        return iterator(bound(key, [&](const Q &q, const K &k) { return order()(q, k) < 0; }), &policy);
+    }
+
+    template <LookupKey<K, Compare> Q>
+    const_iterator upper_bound(const Q &key) const
+    {
+        return const_iterator(bound(key, [&](const Q &q, const K &k) { return order()(q, k) < 0; }), &policy);
+    }
+
+    // The entries with key, which is none or one.
+    template <LookupKey<K, Compare> Q>
+    std::pair<iterator, iterator> equal_range(const Q &key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template <LookupKey<K, Compare> Q>
+    std::pair<const_iterator, const_iterator> equal_range(const Q &key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // The entries with lo <= key < hi, as a view for range-for or
+    // <ranges>.
+    template <LookupKey<K, Compare> Q>
+    std::ranges::subrange<iterator> range(const Q &lo, const Q &hi)
+    {
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    template <LookupKey<K, Compare> Q>
+    std::ranges::subrange<const_iterator> range(const Q &lo, const Q &hi) const
+    {
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    // And the destructor for the binary tree.
+    // In order to prevent memory leaks and keep with
+    // the C++ "RAII" convention, it should see
+    // if there is a root and, if so, call freetree()
+    // on the root.  When the entries need no destructor
+    // there is no walk at all: the pool drops its slabs.
+    ~BinaryTree()
+    {
+        clear();
+    }
+
+    // Empties the tree and lets go of its memory.  The slabs go
+    // with the pool, so the nodes only need their destructors run.
+    void clear()
+    {
+        if constexpr (!std::is_trivially_destructible_v<value_type>){
+            if (root() != nullptr){
+                root()-> freetree([](BinaryTreeNode<K, V> *node) { std::destroy_at(node); }); //we have to call on freetree to delete all nodes  
+            }
+        }
+        header.left = nullptr; //set root to nullptr 
+        pool.reset();
+        lenders.clear();
+    }
+
+    // A read-only copy of the tree laid out for fast lookups.  See
+    // FrozenBinaryTree.
+    FrozenBinaryTree<K, V, Compare> freeze() const
+    {
+        return FrozenBinaryTree<K, V, Compare>(begin(), end(), compare);
+    }
+
+    // Writes the entries to path in the compact binary format
+    // described at BinaryTreeFile, through a temporary file that
+    // replaces path only once it is complete.  False if anything
+    // couldn't be written, in which case path is left as it was.
+    bool save(const std::filesystem::path &path) const
+    {
+        using KeyCodec = BinaryTreeCodec<K>;
+        using ValueCodec = BinaryTreeCodec<V>;
+        std::filesystem::path partial = path;
+        partial += ".partial";
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        BinaryTreeFile::Header header = {};
+        std::memcpy(header.magic, BinaryTreeFile::MAGIC, sizeof(header.magic));
+        header.version = BinaryTreeFile::FORMAT_VERSION;
+        header.key_tag = KeyCodec::tag;
+        header.value_tag = ValueCodec::tag;
+        header.checksum = BinaryTreeFile::checksum(nullptr, 0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        // Entries are encoded into buffer and written out in chunks,
+        // each a multiple of 8 bytes for the checksum.
+        std::string buffer;
+        auto flush = [&](bool last) {
+            std::size_t n = last ? buffer.size() : buffer.size() & ~std::size_t(7);
+            header.checksum = BinaryTreeFile::checksum(buffer.data(), n, header.checksum);
+            header.length += n;
+            out.write(buffer.data(), n);
+            buffer.erase(0, n);
+        };
+        for (const auto &[key, value] : *this){
+            KeyCodec::write(buffer, key);
+            ValueCodec::write(buffer, value);
+            header.count++;
+            if (buffer.size() >= (1 << 20)){
+                flush(false);
+            }
+        }
+        flush(true);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.close();
+        std::error_code error;
+        if (!out){
+            std::filesystem::remove(partial, error);
+            return false;
+        }
+        std::filesystem::rename(partial, path, error);
+        return !error;
+    }
+
+    // Replaces the entries with those save() wrote to path.  The
+    // file is mapped rather than read and, being in key order, built
+    // into a balanced tree in O(n) like the sorted range constructor.
+    // False, with the tree left as it was, if the file is missing,
+    // from another version or another key or value type, fails its
+    // checksum, or doesn't decode to keys in this tree's order.
+    bool load(const std::filesystem::path &path)
+    {
+        using KeyCodec = BinaryTreeCodec<K>;
+        using ValueCodec = BinaryTreeCodec<V>;
+        BinaryTreeFile::View file(path);
+        BinaryTreeFile::Header header;
+        if (file.size < sizeof(header)){
+            return false;
+        }
+        std::memcpy(&header, file.bytes, sizeof(header));
+        if (std::memcmp(header.magic, BinaryTreeFile::MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != BinaryTreeFile::FORMAT_VERSION || header.key_tag != KeyCodec::tag ||
+            header.value_tag != ValueCodec::tag || header.length != file.size - sizeof(header)){
+            return false;
+        }
+        const char *at = file.bytes + sizeof(header);
+        const char *end = at + header.length;
+        if (BinaryTreeFile::checksum(at, header.length) != header.checksum){
+            return false;
+        }
+
+        BinaryTree loaded(compare, alloc);
+        std::vector<BinaryTreeNode<K, V> *> sorted;
+        bool valid = true;
+        try {
+            sorted.reserve(std::min<std::uint64_t>(header.count, header.length));
+            for (std::uint64_t i = 0; valid && i < header.count; ++i){
+                std::optional<K> key = KeyCodec::read(at, end);
+                std::optional<V> value = key ? ValueCodec::read(at, end) : std::nullopt;
+                if (!value){
+                    valid = false;
+                    break;
+                }
+                BinaryTreeNode<K, V> *node = loaded.make_node(std::in_place, std::move(*key), std::move(*value));
+                valid = sorted.empty() || order()(sorted.back()->kv.first, node->kv.first) < 0;
+                sorted.push_back(node);
+            }
+        } catch (...) {
+            for (auto node : sorted){
+                loaded.pool->destroy(node);
+            }
+            throw;
+        }
+        if (!valid || at != end){
+            for (auto node : sorted){
+                loaded.pool->destroy(node);
+            }
+            return false;
+        }
+        loaded.set_root(BinaryTreeNode<K, V>::build(sorted.data(), sorted.size()));
+        swap(loaded);
+        return true;
+    }
+
+    // The number of levels in the tree, 0 when empty.  Insert and
+    // erase keep every stored height exact, so this is the root's.
+    int height()
+    {
+        return BinaryTreeNode<K, V>::getHeight(root());
+    }
+
+    // True if the tree is a valid AVL tree: keys in order, every
+    // stored height exact, no node's subtrees differing in height by
+    // more than one, and every parent link pointing back up.  This
+    // walks the whole tree, so it is for tests and debugging.
+    bool check_invariants() const
+    {
+        if (root() == nullptr){
+            return true;
+        }
+        return root()->parent == &header && root()->check(nullptr, nullptr, compare) >= 0;
+    }
+
+    // What the Policy has seen so far.  With BinaryTreeStats this
+    // is the counters; assigning it a fresh one starts them over.
+    const Policy &stats() const
+    {
+        return policy;
+    }
+
+    Policy &stats()
+    {
+        return policy;
+    }
+
+    // The stats as JSON, along with how many nodes sit at each depth,
+    // which this walks the tree to find.
+    std::string stats_json() const
+        requires(Policy::enabled)
+    {
+        std::vector<std::size_t> depths;
+        if (root()){
+            root()->count_depths(depths, 0);
+        }
+        return policy.json(depths);
+    }
+
+    // This returns the iterators.
+    iterator begin()
+    {
+        return first<false>();
+    }
+    iterator end()
+    {
+        return iterator(&header, &policy);
+    }
+    const_iterator begin() const
+    {
+        return first<true>();
+    }
+    const_iterator end() const
+    {
+        return const_iterator(const_cast<BinaryTreeLinks<K, V> *>(&header), &policy);
+    }
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+    const_iterator cend() const
+    {
+        return end();
     }
 
+protected:
+    using Pool = BinaryTreeNodePool<K, V, Allocator>;
+
+    [[no_unique_address]] Compare compare;
+    [[no_unique_address]] Allocator alloc;
+    [[no_unique_address]] mutable Policy policy;
+
+    // Made on first use, so empty and moved-from trees hold no
+    // memory.  Shared with node handles taken from this tree.
+    std::shared_ptr<Pool> pool;
 
+    // Pools of other trees that nodes inserted here came from.
+    std::vector<std::shared_ptr<Pool>> lenders;
 
+    // header.left is the root.  See BinaryTreeLinks.
+    BinaryTreeLinks<K, V> header;
+
+    Pool &nodes()
+    {
+        if (pool == nullptr){
+            pool = std::allocate_shared<Pool>(alloc, alloc);
+        }
+        return *pool;
+    }
 
-}; 
\ No newline at end of file
+    // The pool whose slab node is in.
+    std::shared_ptr<Pool> owner_of(const BinaryTreeNode<K, V> *node) const
+    {
+        if (pool && (lenders.empty() || pool->owns(node))){
+            return pool;
+        }
+        for (auto &lender : lenders){
+            if (lender->owns(node)){
+                return lender;
+            }
+        }
+        return pool;
+    }
+
+    // Runs one of the node level set operations on this tree and
+    // other, then frees the nodes it left out.
+    template <class Operation>
+    void combine(BinaryTree &other, unsigned threads, Operation &&operation)
+    {
+        BinaryTreeNode<K, V> *theirs = other.root();
+        other.header.left = nullptr;
+        if (theirs){
+            for (auto &lender : other.lenders){
+                lend(lender);
+            }
+            lend(other.pool);
+        }
+        // A policy that records anything would be called from every
+        // thread at once, so then the work stays on this one.
+        int forks = 0;
+        while (!Policy::enabled && (2u << forks) <= threads){
+            forks++;
+        }
+        std::vector<BinaryTreeNode<K, V> *> dropped;
+        set_root(operation(root(), theirs, dropped, forks));
+        for (auto node : dropped){
+            nodes().destroy(node);
+        }
+    }
+
+    // Keeps lender alive for as long as this tree has nodes in it.
+    void lend(const std::shared_ptr<Pool> &lender)
+    {
+        if (lender && lender != pool && std::find(lenders.begin(), lenders.end(), lender) == lenders.end()){
+            lenders.push_back(lender);
+        }
+    }
+
+    // Takes other's nodes and memory, leaving it empty.
+    void take(BinaryTree &other)
+    {
+        pool = std::move(other.pool);
+        lenders = std::move(other.lenders);
+        other.lenders.clear();
+        set_root(other.root());
+        other.header.left = nullptr;
+    }
+
+    // Finds key, or hangs the node from make() for it.  Returns
+    // where the key is and whether it is new.  One walk down finds
+    // either the key or the empty link the new node goes in; make()
+    // only runs after that, so if it throws the tree is untouched.
+    template <class Make>
+    std::pair<iterator, bool> place(const K &key, Make &&make)
+    {
+        BinaryTreeLinks<K, V> *parent = &header;
+        BinaryTreeNode<K, V> **link = &header.left;
+        while (*link != nullptr){
+            BinaryTreeNode<K, V> *node = *link;
+            auto order = this->order()(key, node->kv.first);
+            if (order == 0){
+                return {iterator(node, &policy), false};
+            }
+            link = order < 0 ? &node->left : &node->right;
+            parent = node;
+        }
+        BinaryTreeNode<K, V> *node = make();
+        *link = node;
+        node->parent = parent;
+        if (parent != &header){
+            retrace(static_cast<BinaryTreeNode<K, V> *>(parent));
+        }
+        return {iterator(node, &policy), true};
+    }
+
+    // Rebalances from node up after a node was hung below it.  Once
+    // a subtree is back to the height it had before the insert,
+    // nothing above it can have changed, so the walk stops there.
+    void retrace(BinaryTreeNode<K, V> *node)
+    {
+        for (;;){
+            BinaryTreeLinks<K, V> *up = node->parent;
+            int before = node->height;
+            BinaryTreeNode<K, V> *top = node->rebalance(order());
+            if (up == &header){
+                set_root(top);
+                return;
+            }
+            if (up->left == node){
+                up->left = top;
+            } else {
+                up->right = top;
+            }
+            if (top->height == before){
+                return;
+            }
+            node = static_cast<BinaryTreeNode<K, V> *>(up);
+        }
+    }
+
+    BinaryTreeNode<K, V> *root() const
+    {
+        return header.left;
+    }
+
+    // compare as handed to the nodes, reporting to policy.
+    BinaryTreeOrder<Compare, Policy> order() const
+    {
+        return {compare, policy};
+    }
+
+    template <class... Args>
+    BinaryTreeNode<K, V> *make_node(Args &&...args)
+    {
+        policy.allocated();
+        return nodes().make(std::forward<Args>(args)...);
+    }
+
+    // What clone() takes its nodes from: make_node, and the pool
+    // to give them back to if copying fails.
+    struct NodeMaker
+    {
+        BinaryTree &tree;
+
+        template <class... Args>
+        BinaryTreeNode<K, V> *make(Args &&...args)
+        {
+            return tree.make_node(std::forward<Args>(args)...);
+        }
+
+        void destroy(BinaryTreeNode<K, V> *node)
+        {
+            tree.nodes().destroy(node);
+        }
+    };
+
+    void set_root(BinaryTreeNode<K, V> *node)
+    {
+        header.left = node;
+        if (node){
+            node->parent = &header;
+        }
+    }
+
+    // An iterator on the smallest key, or end() when empty.
+    template <bool IsConst>
+    BinaryTreeIterator<K, V, IsConst, Policy> first() const
+    {
+        BinaryTreeLinks<K, V> *node = const_cast<BinaryTreeLinks<K, V> *>(&header);
+        while (node->left){
+            node = node->left;
+        }
+        return BinaryTreeIterator<K, V, IsConst, Policy>(node, &policy);
+    }
+
+    // The first node, in order, whose key after is true for, or the
+    // header if there is none.  after must be false for a prefix of
+    // the keys and true for the rest.
+    template <class Q, class After>
+    BinaryTreeLinks<K, V> *bound(const Q &key, After &&after) const
+    {
+        BinaryTreeLinks<K, V> *found = const_cast<BinaryTreeLinks<K, V> *>(&header);
+        BinaryTreeNode<K, V> *node = root();
+        while (node != nullptr){
+            if (after(key, node->kv.first)){
+                found = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return found;
+    }
+
+    // The read-only search behind find and contains.  One
+    // comparison per level says both whether this is the node and
+    // which way to go if not.
+    template <LookupKey<K, Compare> Q>
+    BinaryTreeNode<K, V> *lookup(const Q &key) const
+    {
+        BinaryTreeNode<K, V> *node = root();
+        while (node != nullptr){
+            auto order = this->order()(key, node->kv.first);
+            if (order == 0){
+                return node;
+            }
+            node = order < 0 ? node->left : node->right;
+        }
+        return nullptr;
+    }
+};
+
+// And the class for the binary tree node itself.
+template <class K, class V>
+class BinaryTreeNode : public BinaryTreeLinks<K, V>
+{
+    template <class, class, class, class, class>
+    friend class BinaryTree;
+    template <class, class, class>
+    friend class BinaryTreeNodeHandle;
+    template <class, class, bool, class>
+    friend class BinaryTreeIterator;
+
+public:
+    // The constructor, it simply setts the key and the left/right pointers.
+    // Data defaults to whatever the default value is for the data type.
+    BinaryTreeNode(const K &keyin)
+        : BinaryTreeNode(std::in_place, std::piecewise_construct, std::forward_as_tuple(keyin), std::forward_as_tuple())
+    {
+    }
+
+    // A node whose entry is built from args.
+    template <class... Args>
+    explicit BinaryTreeNode(std::in_place_t, Args &&...args)
+        : kv(std::forward<Args>(args)...), height(1) //set height to 1 
+    {
+    }
+
+    // A copy of the subtree under this node, same shape and all.
+    template <class Pool>
+    BinaryTreeNode *clone(Pool &pool) const
+    {
+        BinaryTreeNode *copy = pool.make(std::in_place, kv);
+        copy->height = height;
+        try {
+            if (left){
+                copy->left = left->clone(pool);
+                copy->adopt(copy->left);
+            }
+            if (right){
+                copy->right = right->clone(pool);
+                copy->adopt(copy->right);
+            }
+        } catch (...) {
+            copy->freetree([&](BinaryTreeNode *node) { pool.destroy(node); });
+            throw;
+        }
+        return copy;
+    }
+
+    // This should recursively free the tree.
+    // It should call freetree on left and 
+    // right and then, as the last act,
+    // hand this to release, which deletes it.
+
+    // Yes, you can "suicide" an object in C++,
+    // and this is a case where you want to do it.
+    template <class Release>
+    void freetree(Release &&release)
+    {
+        if (left){ //if left does exxist then free and same for right 
+            left ->freetree(release); 
+        }
+        if (right){
+            right->freetree(release);
+        }
+        release(this); //then delete this 
+    }
+
+protected:
+
+    // Removing a node from a binary tree, returning
+    // a pointer to the now modified tree.
+
+    // If you aren't at the node you are looking for, just set
+    // your new left or right pointer (as approriate, and if it exists) 
+    // to the  result of recursively calling erase, and then return this.
+
+    // If this node does match the key however, check the
+    // child nodes.  If there is no left, assign the right node to a temporary
+    // value, delete this, and return the right node.
+    // If there is no right node, do the same thing.
+    // If there is both a left and right node, check if the left node
+    // doesn't have a right node of its own.  If so, set that node's right
+    // to the current right, assign left to a temporary, and delete this and
+    // return that left node.
+
+    // Finally, if the left node DOES have a right node, take the
+    // largest node out of the left subtree with remove_last, give it
+    // the current node's left and right, delete this and return that
+    // node, rebalanced.  Every node on the way back up is rebalanced
+    // too, so the heights stay exact and the tree stays AVL.
+
+    // What "delete this" means is up to release, which is handed the
+    // unlinked node: the tree gives it back to the pool, extract()
+    // keeps it.
+    template <class Compare, class Release>
+    BinaryTreeNode<K, V> *erase(const K &k, const Compare &compare, Release &&release)
+    {
+        auto order = compare(k, kv.first); //one comparison tells us which of the three cases we are in 
+        if (order < 0){ //if k < key then make sure left = left->erase(k )
+            if (left){
+                left = left ->erase(k, compare, release); 
+                adopt(left);
+            }
+        }
+        else if (order > 0){
+            if (right){ //if right then make sure right = right->erase(k)
+                right = right->erase(k, compare, release); 
+                adopt(right);
+            }
+        }
+        else {
+            if (!left){
+                auto temp = right; 
+                release(this); 
+                return temp; //if left is null make sure auto temp is set to right and delete current node 
+
+            }
+            if (!right){ //if right is null then set to left and delete current node so it returns the temporary 
+                auto temp = left; 
+                release(this); 
+                return temp; 
+            }
+
+            BinaryTreeNode<K,V>*previous; 
+            BinaryTreeNode<K,V>*rest = left->remove_last(previous, compare); //the in order predecessor, and what is left without it 
+            previous->left = rest; 
+            previous ->right = right; 
+            previous->adopt(rest);
+            previous->adopt(right);
+
+            release(this); 
+            return previous->rebalance(compare); //the predecessor takes our place, and may now lean too far 
+        }
+        // Again, not what you will always want to return...
+        return rebalance(compare); //to pass the performance test we need an O(nlogn) complexity so we need to call the function at the bottom 
+    }
+
+    // Takes the node with the largest key out of this subtree,
+    // handing it back in last, and returns what is left,
+    // rebalanced all the way up.
+    template <class Compare>
+    BinaryTreeNode<K, V> *remove_last(BinaryTreeNode<K, V> *&last, const Compare &compare)
+    {
+        if (!right){
+            last = this; 
+            return left; 
+        }
+        right = right->remove_last(last, compare); 
+        adopt(right);
+        return rebalance(compare); 
+    }
+
+    // Adds this subtree's nodes to depths[d] for each depth d below
+    // the tree's root, this node being at depth.
+    void count_depths(std::vector<std::size_t> &depths, std::size_t depth) const
+    {
+        if (depths.size() <= depth){
+            depths.resize(depth + 1);
+        }
+        depths[depth]++;
+        if (left){
+            left->count_depths(depths, depth + 1);
+        }
+        if (right){
+            right->count_depths(depths, depth + 1);
+        }
+    }
+
+    // The height of this subtree if it is a valid AVL tree whose keys
+    // all lie strictly between lo and hi (either may be null for no
+    // bound) and whose nodes all point back at their parents, or -1.
+    template <class Compare>
+    int check(const K *lo, const K *hi, const Compare &compare) const
+    {
+        if ((lo && !(compare(*lo, kv.first) < 0)) || (hi && !(compare(kv.first, *hi) < 0))){
+            return -1; 
+        }
+        if ((left && left->parent != this) || (right && right->parent != this)){
+            return -1; 
+        }
+        int l = left ? left->check(lo, &kv.first, compare) : 0; 
+        int r = right ? right->check(&kv.first, hi, compare) : 0; 
+        if (l < 0 || r < 0 || l - r > 1 || r - l > 1){
+            return -1; 
+        }
+        int measured = 1 + std::max(l, r); 
+        return measured == height ? measured : -1; 
+    }
+
+protected: 
+    // The key and value, stored as the pair iterators hand out.
+    std::pair<const K, V> kv;
+    using BinaryTreeLinks<K, V>::parent;
+    using BinaryTreeLinks<K, V>::left;
+    using BinaryTreeLinks<K, V>::right;
+
+    int height; 
+
+    // Makes this node the parent of child, which has just been
+    // hung under it.
+    void adopt(BinaryTreeNode *child){
+        if (child){
+            child->parent = this;
+        }
+    }
+
+    static int getHeight(BinaryTreeNode*node){
+        if (node == nullptr){ //using lecture 24 slides. if node is null then it just returns 0 otherwise node->height 
+            return 0; 
+        } else{
+            return node->height; 
+        }
+    }
+    
+    void updateHeight(){
+        height = 1 + std::max(getHeight(left),getHeight(right)); //we need to find the max of getHeight(left), getHeight(right)
+    } 
+
+    int balance(){ //return the balance by getting difference of right and left 
+        return getHeight(right)- getHeight(left); 
+    }
+
+    
+    BinaryTreeNode<K,V>*rotateleft(){
+        BinaryTreeNode<K,V>*top = right; //we have to make sure to rotate left that we first grab the top  
+        right = top ->left; 
+        adopt(right);
+        top -> left = this; //once right = top->left then "this" is updated to top->left 
+        top->parent = parent; //top takes our place, the caller fixes the link down to it 
+        parent = top; 
+        this -> updateHeight(); 
+        top->updateHeight(); 
+
+        return top; 
+    }
+
+    BinaryTreeNode<K,V>*rotateright(){
+        BinaryTreeNode<K,V>*top = left; //create node*top such that its named left 
+        left = top ->right; //set left equal to top->right 
+        adopt(left);
+        top ->right = this; //and set top->right equal to this 
+        top->parent = parent; 
+        parent = top; 
+
+        this -> updateHeight(); //ask this to continue updating the height and do same for top 
+        top ->updateHeight(); 
+
+        return top; //return top to rotate right 
+    }
+
+    // compare is the tree's BinaryTreeOrder, which is told about
+    // each rotation.
+    template <class Compare>
+    BinaryTreeNode<K,V>*rebalance(const Compare &compare){
+        updateHeight(); //call on updateheight void 
+
+        int node_bal = balance(); //grab the balance again 
+
+        if (node_bal == 2){ //using lecture 24 pseudocode i found if the node balance is equal to 2 (right heavy) then 
+            if (right && right->balance()< 0 ){
+                right = right ->rotateright(); //we have to update right so right=right->rotateright()
+                compare.rotated(BinaryTreeRotation::right_left);
+            } else {
+                compare.rotated(BinaryTreeRotation::left);
+            }
+            return rotateleft(); //tehn we rotateleft because the right is much heavier 
+        }
+        if (node_bal == -2){ //if the left side is heavy hence more negative then we rotate right 
+            if (left && left->balance()> 0){ //but if the balance is greater than 0
+                left = left ->rotateleft(); //rotate left 
+                compare.rotated(BinaryTreeRotation::left_right);
+            } else {
+                compare.rotated(BinaryTreeRotation::right);
+            }
+            return rotateright(); //since we're left heavy we will rotate right 
+        }
+
+        return this; 
+    }
+
+    // The join-based operations below follow Blelloch, Ferizovic
+    // and Sun, "Just Join for Parallel Ordered Sets".  Each takes
+    // whole subtrees and hands back the root of the result; the
+    // caller links that root in.
+
+    // Makes l and r this node's subtrees.
+    void link(BinaryTreeNode *l, BinaryTreeNode *r){
+        left = l; 
+        right = r; 
+        adopt(l);
+        adopt(r);
+        updateHeight(); 
+    }
+
+    // A balanced tree of the n nodes in order, in O(n).
+    static BinaryTreeNode *build(BinaryTreeNode **order, std::size_t n){
+        if (n == 0){
+            return nullptr; 
+        }
+        std::size_t mid = n / 2; 
+        BinaryTreeNode *top = order[mid]; 
+        top->link(build(order, mid), build(order + mid + 1, n - mid - 1));
+        return top; 
+    }
+
+    // One balanced tree of l, mid and r, where every key in l is
+    // less than mid's and every key in r greater.  The taller side
+    // is walked down until the shorter one fits, so this costs the
+    // difference in their heights.
+    template <class Compare>
+    static BinaryTreeNode *join(BinaryTreeNode *l, BinaryTreeNode *mid, BinaryTreeNode *r, const Compare &compare){
+        if (getHeight(l) > getHeight(r) + 1){
+            return join_right(l, mid, r, compare); 
+        }
+        if (getHeight(r) > getHeight(l) + 1){
+            return join_left(l, mid, r, compare); 
+        }
+        mid->link(l, r);
+        return mid; 
+    }
+
+    template <class Compare>
+    static BinaryTreeNode *join_right(BinaryTreeNode *l, BinaryTreeNode *mid, BinaryTreeNode *r, const Compare &compare){
+        BinaryTreeNode *inner = l->right; 
+        if (getHeight(inner) <= getHeight(r) + 1){
+            mid->link(inner, r);
+            if (getHeight(mid) <= getHeight(l->left) + 1){
+                l->link(l->left, mid);
+                return l; 
+            }
+            compare.rotated(BinaryTreeRotation::right_left);
+            l->link(l->left, mid->rotateright());
+            return l->rotateleft(); 
+        }
+        mid = join_right(inner, mid, r, compare); 
+        l->link(l->left, mid);
+        if (getHeight(mid) <= getHeight(l->left) + 1){
+            return l; 
+        }
+        compare.rotated(BinaryTreeRotation::left);
+        return l->rotateleft(); 
+    }
+
+    template <class Compare>
+    static BinaryTreeNode *join_left(BinaryTreeNode *l, BinaryTreeNode *mid, BinaryTreeNode *r, const Compare &compare){
+        BinaryTreeNode *inner = r->left; 
+        if (getHeight(inner) <= getHeight(l) + 1){
+            mid->link(l, inner);
+            if (getHeight(mid) <= getHeight(r->right) + 1){
+                r->link(mid, r->right);
+                return r; 
+            }
+            compare.rotated(BinaryTreeRotation::left_right);
+            r->link(mid->rotateleft(), r->right);
+            return r->rotateright(); 
+        }
+        mid = join_left(l, mid, inner, compare); 
+        r->link(mid, r->right);
+        if (getHeight(mid) <= getHeight(r->right) + 1){
+            return r; 
+        }
+        compare.rotated(BinaryTreeRotation::right);
+        return r->rotateright(); 
+    }
+
+    // Takes the node with the largest key out of t.
+    template <class Compare>
+    static BinaryTreeNode *split_last(BinaryTreeNode *t, BinaryTreeNode *&last, const Compare &compare){
+        if (!t->right){
+            last = t; 
+            return t->left; 
+        }
+        BinaryTreeNode *r = t->right; 
+        return join(t->left, t, split_last(r, last, compare), compare);
+    }
+
+    // join() without a middle node.
+    template <class Compare>
+    static BinaryTreeNode *join2(BinaryTreeNode *l, BinaryTreeNode *r, const Compare &compare){
+        if (!l){
+            return r; 
+        }
+        BinaryTreeNode *last; 
+        l = split_last(l, last, compare);
+        return join(l, last, r, compare);
+    }
+
+    // t cut around k: the keys less than k, the node holding k if
+    // there is one (its links are stale), and the keys greater.
+    struct Split
+    {
+        BinaryTreeNode *less;
+        BinaryTreeNode *match;
+        BinaryTreeNode *greater;
+    };
+
+    template <class Compare>
+    static Split split(BinaryTreeNode *t, const K &k, const Compare &compare){
+        if (!t){
+            return {nullptr, nullptr, nullptr}; 
+        }
+        BinaryTreeNode *l = t->left; 
+        BinaryTreeNode *r = t->right; 
+        auto order = compare(k, t->kv.first); 
+        if (order < 0){
+            Split s = split(l, k, compare);
+            return {s.less, s.match, join(s.greater, t, r, compare)}; 
+        }
+        if (order > 0){
+            Split s = split(r, k, compare);
+            return {join(l, t, s.less, compare), s.match, s.greater}; 
+        }
+        return {l, t, r}; 
+    }
+
+    // Subtrees at least this tall are worth a thread of their own.
+    static constexpr int PARALLEL_HEIGHT = 14;
+
+    // Runs first and second, the first on its own thread when
+    // forks allows it.  Nodes either drops go on dropped once both
+    // are done, so the pool is only touched from one thread.
+    template <class First, class Second>
+    static std::pair<BinaryTreeNode *, BinaryTreeNode *> both(int forks, std::vector<BinaryTreeNode *> &dropped,
+                                                              First &&first, Second &&second){
+        if (forks <= 0){
+            BinaryTreeNode *l = first(dropped, 0);
+            return {l, second(dropped, 0)}; 
+        }
+        std::vector<BinaryTreeNode *> theirs; 
+        auto pending = std::async(std::launch::async, [&] { return first(theirs, forks - 1); });
+        BinaryTreeNode *r = second(dropped, forks - 1);
+        BinaryTreeNode *l = pending.get();
+        dropped.insert(dropped.end(), theirs.begin(), theirs.end());
+        return {l, r}; 
+    }
+
+    static int forks_for(BinaryTreeNode *a, BinaryTreeNode *b, int forks){
+        return std::min(getHeight(a), getHeight(b)) >= PARALLEL_HEIGHT ? forks : 0; 
+    }
+
+    static void drop_all(BinaryTreeNode *t, std::vector<BinaryTreeNode *> &dropped){
+        if (t){
+            t->freetree([&](BinaryTreeNode *node) { dropped.push_back(node); });
+        }
+    }
+
+    // Every key in a or b, keeping a's node where both have one.
+    template <class Compare>
+    static BinaryTreeNode *unite(BinaryTreeNode *a, BinaryTreeNode *b, std::vector<BinaryTreeNode *> &dropped, int forks,
+                              const Compare &compare){
+        if (!a){
+            return b; 
+        }
+        if (!b){
+            return a; 
+        }
+        int fork = forks_for(a, b, forks);
+        Split s = split(b, a->kv.first, compare);
+        if (s.match){
+            dropped.push_back(s.match);
+        }
+        auto [l, r] = both(fork, dropped,
+            [&](auto &out, int f) { return unite(a->left, s.less, out, f, compare); },
+            [&](auto &out, int f) { return unite(a->right, s.greater, out, f, compare); });
+        return join(l, a, r, compare);
+    }
+
+    // The keys in both, in a's nodes.
+    template <class Compare>
+    static BinaryTreeNode *intersect(BinaryTreeNode *a, BinaryTreeNode *b, std::vector<BinaryTreeNode *> &dropped, int forks,
+                              const Compare &compare){
+        if (!a || !b){
+            drop_all(a, dropped);
+            drop_all(b, dropped);
+            return nullptr; 
+        }
+        int fork = forks_for(a, b, forks);
+        Split s = split(b, a->kv.first, compare);
+        auto [l, r] = both(fork, dropped,
+            [&](auto &out, int f) { return intersect(a->left, s.less, out, f, compare); },
+            [&](auto &out, int f) { return intersect(a->right, s.greater, out, f, compare); });
+        if (s.match){
+            dropped.push_back(s.match);
+            return join(l, a, r, compare);
+        }
+        dropped.push_back(a);
+        return join2(l, r, compare);
+    }
+
+    // The keys in a that aren't in b.
+    template <class Compare>
+    static BinaryTreeNode *subtract(BinaryTreeNode *a, BinaryTreeNode *b, std::vector<BinaryTreeNode *> &dropped, int forks,
+                              const Compare &compare){
+        if (!a || !b){
+            drop_all(b, dropped);
+            return a; 
+        }
+        int fork = forks_for(a, b, forks);
+        Split s = split(a, b->kv.first, compare);
+        if (s.match){
+            dropped.push_back(s.match);
+        }
+        auto [l, r] = both(fork, dropped,
+            [&](auto &out, int f) { return subtract(s.less, b->left, out, f, compare); },
+            [&](auto &out, int f) { return subtract(s.greater, b->right, out, f, compare); });
+        dropped.push_back(b);
+        return join2(l, r, compare);
+    }
+}; 
+
+// An immutable snapshot of a tree, for data that is loaded once and
+// then only read.  Keys and values sit in two arrays in Eytzinger
+// order: slot k (counting from 1) has its children at 2k and 2k + 1,
+// the way a heap does.  A lookup goes down the top of that implicit
+// tree through a handful of cache lines that every lookup shares,
+// with no pointers to chase, no branch to mispredict on each level,
+// and the cache line a few levels down fetched ahead of time.  There is no
+// per-entry overhead beyond the key and the value.
+template <class K, class V, class Compare>
+class FrozenBinaryTree
+{
+public:
+    // Iterates in key order, handing out the key and value as a
+    // pair of references since they aren't stored together.  That
+    // pair is the value_type as well; C++20 has no common reference
+    // between it and std::pair<const K, V>, and without one this
+    // wouldn't count as a std::bidirectional_iterator.
+    class iterator
+    {
+        friend class FrozenBinaryTree;
+
+        iterator(const FrozenBinaryTree *treein, std::size_t slotin) : tree(treein), slot(slotin)
+        {
+        }
+
+    public:
+        using value_type = std::pair<const K &, const V &>;
+        using reference = std::pair<const K &, const V &>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_concept = std::bidirectional_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+
+        iterator() = default;
+
+        reference operator*() const
+        {
+            return {tree->keys[slot - 1], tree->values[slot - 1]};
+        }
+
+        bool operator==(const iterator &other) const
+        {
+            return slot == other.slot;
+        }
+
+        // The in order successor: the leftmost slot under the right
+        // child, or else up past every slot we are the right child
+        // of, and once more.  Slot 0 is the end.
+        iterator &operator++()
+        {
+            if (2 * slot + 1 <= tree->size()){
+                slot = 2 * slot + 1;
+                while (2 * slot <= tree->size()){
+                    slot = 2 * slot;
+                }
+            } else {
+                slot >>= std::countr_one(slot) + 1;
+            }
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator &operator--()
+        {
+            if (slot == 0){
+                slot = tree->size() ? 1 : 0;
+                while (slot && 2 * slot + 1 <= tree->size()){
+                    slot = 2 * slot + 1;
+                }
+            } else if (2 * slot <= tree->size()){
+                slot = 2 * slot;
+                while (2 * slot + 1 <= tree->size()){
+                    slot = 2 * slot + 1;
+                }
+            } else {
+                slot >>= std::countr_zero(slot) + 1;
+            }
+            return *this;
+        }
+
+        iterator operator--(int)
+        {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+    private:
+        const FrozenBinaryTree *tree = nullptr;
+        std::size_t slot = 0;
+    };
+
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using const_iterator = iterator;
+
+    FrozenBinaryTree() = default;
+
+    // Takes entries in key order with no repeats, as a BinaryTree
+    // ordered by compare iterates.
+    template <std::input_iterator It>
+    FrozenBinaryTree(It first, It last, const Compare &comparein = Compare()) : compare(comparein)
+    {
+        std::vector<std::pair<const K &, const V &>> sorted;
+        for (; first != last; ++first){
+            sorted.emplace_back(first->first, first->second);
+        }
+        std::vector<std::size_t> order(sorted.size() + 1);
+        std::size_t next = 0;
+        number(order, 1, next);
+        keys.reserve(sorted.size());
+        values.reserve(sorted.size());
+        for (std::size_t slot = 1; slot <= sorted.size(); ++slot){
+            keys.push_back(sorted[order[slot]].first);
+            values.push_back(sorted[order[slot]].second);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return keys.size();
+    }
+
+    bool empty() const
+    {
+        return keys.empty();
+    }
+
+    template <LookupKey<K, Compare> Q>
+    const V *find(const Q &key) const
+    {
+        std::size_t slot = lower_bound_slot(key);
+        return slot && compare(key, keys[slot - 1]) == 0 ? &values[slot - 1] : nullptr;
+    }
+
+    template <LookupKey<K, Compare> Q>
+    bool contains(const Q &key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    iterator begin() const
+    {
+        std::size_t slot = empty() ? 0 : 1;
+        while (slot && 2 * slot <= size()){
+            slot = 2 * slot;
+        }
+        return iterator(this, slot);
+    }
+
+    iterator end() const
+    {
+        return iterator(this, 0);
+    }
+
+    // Bytes held by the two arrays.
+    std::size_t memory_used() const
+    {
+        return keys.capacity() * sizeof(K) + values.capacity() * sizeof(V);
+    }
+
+private:
+    // How many keys fit in a cache line; prefetching that many
+    // times further down is four levels ahead for 4 byte keys.
+    static constexpr std::size_t PREFETCH_STRIDE = std::max<std::size_t>(1, 64 / sizeof(K));
+
+    // Gives every slot under slot its place in key order.
+    static void number(std::vector<std::size_t> &order, std::size_t slot, std::size_t &next)
+    {
+        if (slot < order.size()){
+            number(order, 2 * slot, next);
+            order[slot] = next++;
+            number(order, 2 * slot + 1, next);
+        }
+    }
+
+    // The slot of the first key not less than key, 0 if none is.
+    // The loop goes left or right by adding the comparison rather
+    // than branching on it, and ends at a slot past the bottom whose
+    // bits record the turns taken; the answer is where we last went
+    // left, which is that slot with its trailing right turns (ones)
+    // and the last left turn shifted off.
+    template <class Q>
+    std::size_t lower_bound_slot(const Q &key) const
+    {
+        std::size_t n = size();
+        std::size_t slot = 1;
+        while (slot <= n){
+#if defined(__GNUC__)
+            __builtin_prefetch(keys.data() + std::min(slot * PREFETCH_STRIDE, n) - 1);
+#endif
+            slot = 2 * slot + (compare(keys[slot - 1], key) < 0);
+        }
+        return slot >> (std::countr_one(slot) + 1);
+    }
+
+    [[no_unique_address]] Compare compare;
+    std::vector<K> keys;
+    std::vector<V> values;
+};
+
+// A tree that any number of threads can read and write at once.
+// Readers never lock or wait: they only bump a counter on the way in
+// and out.  Writers take turns on a mutex and never change a node a
+// reader might see.  They copy the path down to the change, with AVL
+// rebalancing along it, and publish the new root in one atomic
+// store.  A replaced node is freed once every reader that could have
+// reached it has left, which writers check in batches.
+//
+// Writers are fully serialized: one mutex covers every insert and
+// erase, so only one runs at a time however many threads are writing.
+// Reads scale with threads but writes don't, and a workload that is
+// half writes is held to the speed of a single writer.
+//
+// Values are handed out by copy, since the node they came from may be
+// gone by the time the caller looks at them.
+template <class K, class V, class Compare>
+class ConcurrentBinaryTree
+{
+    struct Node
+    {
+        K key;
+        V value;
+        Node *left;
+        Node *right;
+        int height;
+    };
+
+    // Readers bump a counter in one of these stripes so that they
+    // don't all fight over the same cache line.
+    static constexpr int READER_STRIPES = 64;
+
+    // Replaced nodes are held until this many have built up, so a
+    // writer only waits for readers once per batch.
+    static constexpr std::size_t RETIRE_BATCH = 1024;
+
+    struct alignas(64) ReaderStripe
+    {
+        std::atomic<long> count[2];
+    };
+
+    // Marks a reader as inside the tree for as long as it lives.
+    // It counts itself on the side phase says new readers go to.
+    class ReadSection
+    {
+    public:
+        explicit ReadSection(const ConcurrentBinaryTree &tree)
+        {
+            ReaderStripe &stripe = tree.stripes[stripe_index()];
+            count = &stripe.count[tree.phase.load() & 1];
+            count->fetch_add(1);
+        }
+
+        ~ReadSection()
+        {
+            count->fetch_sub(1, std::memory_order_release);
+        }
+
+        ReadSection(const ReadSection &) = delete;
+        ReadSection &operator=(const ReadSection &) = delete;
+
+    private:
+        std::atomic<long> *count;
+    };
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using key_compare = Compare;
+
+    ConcurrentBinaryTree() = default;
+
+    explicit ConcurrentBinaryTree(const Compare &comparein) : compare(comparein)
+    {
+    }
+
+    ConcurrentBinaryTree(const ConcurrentBinaryTree &) = delete;
+    ConcurrentBinaryTree &operator=(const ConcurrentBinaryTree &) = delete;
+
+    // Nobody may be using the tree by now, so there is no waiting.
+    ~ConcurrentBinaryTree()
+    {
+        freetree(root.load(std::memory_order_relaxed));
+        for (Node *node : retired){
+            delete node;
+        }
+    }
+
+    template <LookupKey<K, Compare> Q>
+    bool contains(const Q &key) const
+    {
+        ReadSection reading(*this);
+        return search(key) != nullptr;
+    }
+
+    // A copy of the value for key, if it is there.
+    template <LookupKey<K, Compare> Q>
+    std::optional<V> lookup(const Q &key) const
+    {
+        ReadSection reading(*this);
+        if (Node *node = search(key)){
+            return node->value;
+        }
+        return std::nullopt;
+    }
+
+    // Sets the value for key.  True if the key is new.
+    bool insert(const K &key, const V &value)
+    {
+        std::lock_guard<std::mutex> writing(writer);
+        bool added = false;
+        try {
+            publish(insert(root.load(std::memory_order_relaxed), key, value, added));
+        } catch (...) {
+            abandon();
+            throw;
+        }
+        count.fetch_add(added, std::memory_order_relaxed);
+        return added;
+    }
+
+    // True if there was a key to remove.
+    bool erase(const K &key)
+    {
+        std::lock_guard<std::mutex> writing(writer);
+        Node *old = root.load(std::memory_order_relaxed);
+        try {
+            Node *updated = erase(old, key);
+            if (updated == old){
+                // Any change leaves a different root, and replaced
+                // nodes aren't freed yet to come back at the same
+                // address, so the same root means key wasn't there.
+                return false;
+            }
+            publish(updated);
+        } catch (...) {
+            abandon();
+            throw;
+        }
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // Calls f(key, value) in key order on one consistent version of
+    // the tree; writes made meanwhile aren't seen.
+    template <class F>
+    void for_each(F &&f) const
+    {
+        ReadSection reading(*this);
+        walk(root.load(), f);
+    }
+
+    // The number of levels, 0 when empty.
+    int height() const
+    {
+        ReadSection reading(*this);
+        return getHeight(root.load());
+    }
+
+private:
+    // Each thread picks a stripe the first time it reads and keeps it.
+    static int stripe_index()
+    {
+        static std::atomic<int> next_stripe{0};
+        static thread_local int stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % READER_STRIPES;
+        return stripe;
+    }
+
+    template <class Q>
+    Node *search(const Q &key) const
+    {
+        // seq_cst, like the store in publish: see reclaim.
+        Node *node = root.load();
+        while (node != nullptr){
+            auto order = compare(key, node->key);
+            if (order == 0){
+                return node;
+            }
+            node = order < 0 ? node->left : node->right;
+        }
+        return nullptr;
+    }
+
+    template <class F>
+    static void walk(Node *node, F &f)
+    {
+        if (node){
+            walk(node->left, f);
+            f(static_cast<const K &>(node->key), static_cast<const V &>(node->value));
+            walk(node->right, f);
+        }
+    }
+
+    static void freetree(Node *node)
+    {
+        if (node){
+            freetree(node->left);
+            freetree(node->right);
+            delete node;
+        }
+    }
+
+    static int getHeight(const Node *node)
+    {
+        return node ? node->height : 0;
+    }
+
+    // A new node for this write.  It is remembered in made until the
+    // write is published, so that if building the rest of the path
+    // throws it can be freed again.
+    Node *make(const K &key, const V &value, Node *left, Node *right)
+    {
+        made.reserve(made.size() + 1);
+        Node *node = new Node{key, value, left, right, 1 + std::max(getHeight(left), getHeight(right))};
+        made.push_back(node);
+        return node;
+    }
+
+    // Notes a node that this write replaces.  Readers can still reach
+    // it from the current root, so it only joins retired once publish
+    // has stored the new one.
+    void retire(Node *node)
+    {
+        displaced.push_back(node);
+    }
+
+    // Undoes a write that threw before it was published: the copies
+    // it made are freed and the nodes it meant to replace stay.
+    void abandon()
+    {
+        for (Node *node : made){
+            delete node;
+        }
+        made.clear();
+        displaced.clear();
+    }
+
+    // A new node for key and value over left and right, rotated if
+    // one side is two levels taller.  Nodes the rotation replaces
+    // are retired.
+    Node *balance(const K &key, const V &value, Node *left, Node *right)
+    {
+        int hl = getHeight(left);
+        int hr = getHeight(right);
+        if (hl > hr + 1){
+            if (getHeight(left->left) >= getHeight(left->right)){
+                retire(left);
+                return make(left->key, left->value, left->left, make(key, value, left->right, right));
+            }
+            Node *inner = left->right;
+            retire(left);
+            retire(inner);
+            return make(inner->key, inner->value, make(left->key, left->value, left->left, inner->left),
+                        make(key, value, inner->right, right));
+        }
+        if (hr > hl + 1){
+            if (getHeight(right->right) >= getHeight(right->left)){
+                retire(right);
+                return make(right->key, right->value, make(key, value, left, right->left), right->right);
+            }
+            Node *inner = right->left;
+            retire(right);
+            retire(inner);
+            return make(inner->key, inner->value, make(key, value, left, inner->left),
+                        make(right->key, right->value, inner->right, right->right));
+        }
+        return make(key, value, left, right);
+    }
+
+    Node *insert(Node *node, const K &key, const V &value, bool &added)
+    {
+        if (node == nullptr){
+            added = true;
+            return make(key, value, nullptr, nullptr);
+        }
+        retire(node);
+        auto order = compare(key, node->key);
+        if (order < 0){
+            return balance(node->key, node->value, insert(node->left, key, value, added), node->right);
+        }
+        if (order > 0){
+            return balance(node->key, node->value, node->left, insert(node->right, key, value, added));
+        }
+        return make(node->key, value, node->left, node->right);
+    }
+
+    // Takes the smallest node out from under node; min is left on it.
+    Node *remove_min(Node *node, Node *&min)
+    {
+        retire(node);
+        if (node->left == nullptr){
+            min = node;
+            return node->right;
+        }
+        return balance(node->key, node->value, remove_min(node->left, min), node->right);
+    }
+
+    // The tree under node without key.  If key isn't there this is
+    // node itself, and nothing is copied.
+    Node *erase(Node *node, const K &key)
+    {
+        if (node == nullptr){
+            return nullptr;
+        }
+        auto order = compare(key, node->key);
+        if (order < 0){
+            Node *left = erase(node->left, key);
+            if (left == node->left){
+                return node;
+            }
+            retire(node);
+            return balance(node->key, node->value, left, node->right);
+        }
+        if (order > 0){
+            Node *right = erase(node->right, key);
+            if (right == node->right){
+                return node;
+            }
+            retire(node);
+            return balance(node->key, node->value, node->left, right);
+        }
+        retire(node);
+        if (node->left == nullptr){
+            return node->right;
+        }
+        if (node->right == nullptr){
+            return node->left;
+        }
+        Node *min;
+        Node *right = remove_min(node->right, min);
+        return balance(min->key, min->value, node->left, right);
+    }
+
+    // Makes updated the root readers see, retires the nodes it
+    // replaces, then frees what has been retired if there is enough of
+    // it.  Room in retired is made first, so once the root is stored
+    // nothing can throw.
+    void publish(Node *updated)
+    {
+        retired.reserve(retired.size() + displaced.size());
+        root.store(updated);
+        retired.insert(retired.end(), displaced.begin(), displaced.end());
+        displaced.clear();
+        made.clear();
+        if (retired.size() >= RETIRE_BATCH){
+            reclaim();
+        }
+    }
+
+    // Flips phase to send new readers to the other counter, then
+    // waits for the old counter to drain.  Doing that for both
+    // counters is a grace period: no reader that started before it
+    // can still be holding a node retired before it.
+    //
+    // A reader bumps its counter and then loads the root; publish
+    // stores the root and then this reads the counters.  That only
+    // works if one of the two sees the other, which takes seq_cst on
+    // all four, the root included.  With release/acquire on the root
+    // a reader could load the old root after its counter was seen
+    // empty.
+    void reclaim()
+    {
+        for (int flip = 0; flip < 2; ++flip){
+            unsigned old = phase.fetch_add(1) & 1;
+            for (;;){
+                long total = 0;
+                for (auto &stripe : stripes){
+                    total += stripe.count[old].load();
+                }
+                if (total == 0){
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        for (Node *node : retired){
+            delete node;
+        }
+        retired.clear();
+    }
+
+    std::atomic<Node *> root{nullptr};
+    std::atomic<std::size_t> count{0};
+    mutable ReaderStripe stripes[READER_STRIPES] = {};
+    std::atomic<unsigned> phase{0};
+    std::mutex writer;
+    std::vector<Node *> retired;
+    // What the write in progress has built and means to replace.
+    std::vector<Node *> made;
+    std::vector<Node *> displaced;
+    [[no_unique_address]] Compare compare;
+};
+
+// A tree whose versions never change.  insert and erase hand back a
+// new version and leave the one they were called on as it was.  The
+// new version copies only the path down to the change, with AVL
+// rebalancing along it, O(log n) nodes, and shares every other
+// subtree with the old one.  Nodes are reference counted and freed
+// when the last version using them goes.
+//
+// So a snapshot is a copy of the tree, which is one pointer and
+// O(1), and stays valid however the tree it was taken from moves on.
+// Versions can be read from other threads while new ones are made;
+// the same version must not be assigned to while being read.
+template <class K, class V, class Compare>
+class PersistentBinaryTree
+{
+    struct Node;
+    using Link = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        K key;
+        V value;
+        Link left;
+        Link right;
+        int height;
+    };
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using key_compare = Compare;
+
+    PersistentBinaryTree() = default;
+
+    explicit PersistentBinaryTree(const Compare &comparein) : compare(comparein)
+    {
+    }
+
+    // This version with key set to value.
+    [[nodiscard]] PersistentBinaryTree insert(const K &key, const V &value) const
+    {
+        bool added = false;
+        Link updated = insert(root, key, value, added);
+        return PersistentBinaryTree(std::move(updated), count + added, compare);
+    }
+
+    // This version without key.  If key isn't there the result
+    // shares this version's root and nothing is copied.
+    [[nodiscard]] PersistentBinaryTree erase(const K &key) const
+    {
+        Link updated = erase(root, key);
+        if (updated == root){
+            return *this;
+        }
+        return PersistentBinaryTree(std::move(updated), count - 1, compare);
+    }
+
+    // The value for key, or nullptr.  It lives as long as any version
+    // that has it does.
+    template <LookupKey<K, Compare> Q>
+    const V *find(const Q &key) const
+    {
+        const Node *node = root.get();
+        while (node != nullptr){
+            auto order = compare(key, node->key);
+            if (order == 0){
+                return &node->value;
+            }
+            node = order < 0 ? node->left.get() : node->right.get();
+        }
+        return nullptr;
+    }
+
+    template <LookupKey<K, Compare> Q>
+    bool contains(const Q &key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    // Calls f(key, value) in key order.
+    template <class F>
+    void for_each(F &&f) const
+    {
+        walk(root.get(), f);
+    }
+
+    // The number of levels, 0 when empty.
+    int height() const
+    {
+        return getHeight(root.get());
+    }
+
+    // True if other is this very version or one with the same root,
+    // which is an O(1) way to tell that nothing has changed.
+    bool same_version(const PersistentBinaryTree &other) const
+    {
+        return root == other.root;
+    }
+
+private:
+    PersistentBinaryTree(Link rootin, std::size_t countin, const Compare &comparein)
+        : root(std::move(rootin)), count(countin), compare(comparein)
+    {
+    }
+
+    template <class F>
+    static void walk(const Node *node, F &f)
+    {
+        if (node){
+            walk(node->left.get(), f);
+            f(node->key, node->value);
+            walk(node->right.get(), f);
+        }
+    }
+
+    static int getHeight(const Node *node)
+    {
+        return node ? node->height : 0;
+    }
+
+    static Link make(const K &key, const V &value, Link left, Link right)
+    {
+        int height = 1 + std::max(getHeight(left.get()), getHeight(right.get()));
+        return std::make_shared<const Node>(Node{key, value, std::move(left), std::move(right), height});
+    }
+
+    // A new node for key and value over left and right, rotated if
+    // one side is two levels taller.  The nodes a rotation moves are
+    // copied; the old ones may still be in other versions.
+    static Link balance(const K &key, const V &value, Link left, Link right)
+    {
+        int hl = getHeight(left.get());
+        int hr = getHeight(right.get());
+        if (hl > hr + 1){
+            if (getHeight(left->left.get()) >= getHeight(left->right.get())){
+                return make(left->key, left->value, left->left, make(key, value, left->right, std::move(right)));
+            }
+            const Node *inner = left->right.get();
+            return make(inner->key, inner->value, make(left->key, left->value, left->left, inner->left),
+                        make(key, value, inner->right, std::move(right)));
+        }
+        if (hr > hl + 1){
+            if (getHeight(right->right.get()) >= getHeight(right->left.get())){
+                return make(right->key, right->value, make(key, value, std::move(left), right->left), right->right);
+            }
+            const Node *inner = right->left.get();
+            return make(inner->key, inner->value, make(key, value, std::move(left), inner->left),
+                        make(right->key, right->value, inner->right, right->right));
+        }
+        return make(key, value, std::move(left), std::move(right));
+    }
+
+    Link insert(const Link &node, const K &key, const V &value, bool &added) const
+    {
+        if (node == nullptr){
+            added = true;
+            return make(key, value, nullptr, nullptr);
+        }
+        auto order = compare(key, node->key);
+        if (order < 0){
+            return balance(node->key, node->value, insert(node->left, key, value, added), node->right);
+        }
+        if (order > 0){
+            return balance(node->key, node->value, node->left, insert(node->right, key, value, added));
+        }
+        return make(node->key, value, node->left, node->right);
+    }
+
+    // Takes the smallest node out from under node; min is left on it.
+    static Link remove_min(const Link &node, const Node *&min)
+    {
+        if (node->left == nullptr){
+            min = node.get();
+            return node->right;
+        }
+        return balance(node->key, node->value, remove_min(node->left, min), node->right);
+    }
+
+    // The tree under node without key.  If key isn't there this is
+    // node itself, and nothing is copied.
+    Link erase(const Link &node, const K &key) const
+    {
+        if (node == nullptr){
+            return nullptr;
+        }
+        auto order = compare(key, node->key);
+        if (order < 0){
+            Link left = erase(node->left, key);
+            if (left == node->left){
+                return node;
+            }
+            return balance(node->key, node->value, std::move(left), node->right);
+        }
+        if (order > 0){
+            Link right = erase(node->right, key);
+            if (right == node->right){
+                return node;
+            }
+            return balance(node->key, node->value, node->left, std::move(right));
+        }
+        if (node->left == nullptr){
+            return node->right;
+        }
+        if (node->right == nullptr){
+            return node->left;
+        }
+        const Node *min;
+        Link right = remove_min(node->right, min);
+        return balance(min->key, min->value, node->left, std::move(right));
+    }
+
+    Link root;
+    std::size_t count = 0;
+    [[no_unique_address]] Compare compare;
+};
+
+// A BinaryTree whose nodes come from a std::pmr::memory_resource,
+// e.g. a monotonic_buffer_resource for request-scoped work.
+namespace pmr
+{
+template <class K, class V, class Compare = BinaryTreeCompare<K>>
+using BinaryTree = ::BinaryTree<K, V, Compare, std::pmr::polymorphic_allocator<std::pair<const K, V>>>;
+}
@@ -0,0 +1,769 @@
+// Benchmarks for BinaryTree.  These are not part of the test suite,
+// run them by hand from the build directory:
+//
+//   ./treebench                 runs everything
+//   ./treebench iterate [n]     full in order walks
+//   ./treebench scan [n]        many short walks: begin() and the
+//                               next 9 entries
+//   ./treebench alloc [n]       build and teardown with the default
+//                               allocator and in a pmr arena
+//   ./treebench bulk [n]        building from sorted entries vs. n
+//                               inserts
+//   ./treebench setops [n]      unite/intersect/subtract of two n key
+//                               trees vs. key at a time loops
+//   ./treebench freeze [n]      lookups and memory, BinaryTree vs.
+//                               its frozen snapshot
+//   ./treebench ranges [n]      sums over key windows with range() vs.
+//                               skipping from begin(), and erasing a
+//                               window at once vs. key by key
+//   ./treebench churn [n]       height and lookup time over rounds of
+//                               random erases and inserts
+//   ./treebench compare [n]     lookups with int64 keys and with string
+//                               keys, short and with a long shared
+//                               prefix
+//   ./treebench persist [n]     writing a tree of string keys out and
+//                               reading it back: text and operator[]
+//                               vs. save() and load()
+//   ./treebench persistent [n]  PersistentBinaryTree: update cost, memory
+//                               kept per update, and snapshots vs.
+//                               copying a BinaryTree
+//   ./treebench stats [n]       one workload on BinaryTree and on the
+//                               same tree counting with BinaryTreeStats,
+//                               then the counts as JSON
+//   ./treebench concurrent [n]  ops/s with 1 to 64 threads at 95/5 and
+//                               50/50 reads/writes: ConcurrentBinaryTree
+//                               vs. BinaryTree behind a mutex or a
+//                               shared_mutex
+//
+// n is the number of keys in the tree (default 1000000).  std::map is
+// timed alongside as a reference.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <malloc.h>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static std::vector<int64_t> make_keys(size_t n)
+{
+    std::vector<int64_t> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = (int64_t) i * 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine{42});
+    return keys;
+}
+
+template <class Map>
+static int64_t walk(const Map &m)
+{
+    int64_t sum = 0;
+    for (const auto &[key, value] : m) {
+        sum += key + value;
+    }
+    return sum;
+}
+
+template <class Map>
+static int64_t scan_first(const Map &m, int count)
+{
+    int64_t sum = 0;
+    auto it = m.begin();
+    for (int i = 0; i < count && it != m.end(); ++i, ++it) {
+        sum += it->first;
+    }
+    return sum;
+}
+
+template <class Map>
+static void fill(Map &m, const std::vector<int64_t> &keys)
+{
+    for (int64_t k : keys) {
+        m[k] = k;
+    }
+}
+
+static void bench_iterate(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    BinaryTree<int64_t, int64_t> b;
+    std::map<int64_t, int64_t> m;
+    fill(b, keys);
+    fill(m, keys);
+
+    const int rounds = 10;
+    printf("iterate: %zu keys, %d full walks\n", n, rounds);
+    printf("%-12s %14s\n", "", "ns/entry");
+    int64_t check[2] = {0, 0};
+    auto start = bench_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        check[0] += walk(b);
+    }
+    printf("%-12s %14.2f\n", "BinaryTree", seconds_since(start) * 1e9 / (n * rounds));
+    start = bench_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        check[1] += walk(m);
+    }
+    printf("%-12s %14.2f\n", "std::map", seconds_since(start) * 1e9 / (n * rounds));
+    if (check[0] != check[1]) {
+        fprintf(stderr, "walks disagree\n");
+    }
+}
+
+static void bench_scan(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    BinaryTree<int64_t, int64_t> b;
+    std::map<int64_t, int64_t> m;
+    fill(b, keys);
+    fill(m, keys);
+
+    const int scans = 1000000;
+    const int length = 10;
+    printf("scan: %zu keys, %d scans of the first %d entries\n", n, scans, length);
+    printf("%-12s %14s\n", "", "ns/scan");
+    int64_t check[2] = {0, 0};
+    auto start = bench_clock::now();
+    for (int s = 0; s < scans; ++s) {
+        check[0] += scan_first(b, length);
+    }
+    printf("%-12s %14.1f\n", "BinaryTree", seconds_since(start) * 1e9 / scans);
+    start = bench_clock::now();
+    for (int s = 0; s < scans; ++s) {
+        check[1] += scan_first(m, length);
+    }
+    printf("%-12s %14.1f\n", "std::map", seconds_since(start) * 1e9 / scans);
+    if (check[0] != check[1]) {
+        fprintf(stderr, "scans disagree\n");
+    }
+}
+
+// Builds a tree of keys and throws it away, reporting both times.
+template <class Map, class... Args>
+static void build_and_drop(const char *label, const std::vector<int64_t> &keys, Args &&...args)
+{
+    auto start = bench_clock::now();
+    auto *m = new Map(std::forward<Args>(args)...);
+    for (int64_t k : keys) {
+        (*m)[k];
+    }
+    double build = seconds_since(start);
+    start = bench_clock::now();
+    delete m;
+    printf("%-22s %12.3f %12.4f\n", label, build, seconds_since(start));
+}
+
+static void bench_alloc(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    printf("alloc: %zu keys\n", n);
+    printf("%-22s %12s %12s\n", "", "build s", "teardown s");
+    build_and_drop<BinaryTree<int64_t, int64_t>>("BinaryTree", keys);
+    build_and_drop<BinaryTree<int64_t, std::string>>("BinaryTree, strings", keys);
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        build_and_drop<pmr::BinaryTree<int64_t, int64_t>>("pmr::BinaryTree arena", keys, &arena);
+    }
+    build_and_drop<std::map<int64_t, int64_t>>("std::map", keys);
+    build_and_drop<std::map<int64_t, std::string>>("std::map, strings", keys);
+}
+
+static void bench_bulk(size_t n)
+{
+    std::vector<std::pair<int64_t, int64_t>> sorted;
+    for (size_t i = 0; i < n; ++i) {
+        sorted.emplace_back((int64_t) i * 2, (int64_t) i);
+    }
+    printf("bulk: %zu sorted entries\n", n);
+    auto start = bench_clock::now();
+    {
+        BinaryTree<int64_t, int64_t> b;
+        for (auto &[k, v] : sorted) {
+            b[k] = v;
+        }
+        printf("%-22s %10.3f s  height %d\n", "operator[] each", seconds_since(start), b.height());
+    }
+    start = bench_clock::now();
+    BinaryTree<int64_t, int64_t> b(sorted.begin(), sorted.end());
+    printf("%-22s %10.3f s  height %d\n", "range constructor", seconds_since(start), b.height());
+}
+
+static void bench_setops(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    std::vector<int64_t> other(n);
+    std::mt19937_64 rng(9);
+    for (auto &k : other) {
+        // About half of these are also in keys.
+        k = (int64_t) (rng() % (n * 4));
+    }
+    BinaryTree<int64_t, int64_t> a, b;
+    fill(a, keys);
+    fill(b, other);
+    unsigned max_threads = std::max(2u, std::thread::hardware_concurrency());
+    printf("setops: two trees of %zu keys\n", n);
+    printf("%-12s %14s", "", "key at a time");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        printf("  %8s x%-3u", "join", threads);
+    }
+    printf("\n");
+
+    auto run = [&](const char *label, auto &&loop, auto &&join) {
+        printf("%-12s", label);
+        BinaryTree<int64_t, int64_t> x = a, y = b;
+        auto start = bench_clock::now();
+        loop(x, y);
+        printf(" %12.3f s", seconds_since(start));
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            BinaryTree<int64_t, int64_t> x = a, y = b;
+            start = bench_clock::now();
+            join(x, std::move(y), threads);
+            printf("  %10.3f s", seconds_since(start));
+        }
+        printf("\n");
+    };
+    run("unite",
+        [](auto &x, auto &y) {
+            for (auto &[k, v] : y) {
+                x.try_emplace(k, v);
+            }
+        },
+        [](auto &x, auto &&y, unsigned t) { x.unite(std::move(y), t); });
+    run("intersect",
+        [](auto &x, auto &y) {
+            std::vector<int64_t> gone;
+            for (auto &[k, v] : x) {
+                if (!y.contains(k)) {
+                    gone.push_back(k);
+                }
+            }
+            for (auto k : gone) {
+                x.erase(k);
+            }
+        },
+        [](auto &x, auto &&y, unsigned t) { x.intersect(std::move(y), t); });
+    run("subtract",
+        [](auto &x, auto &y) {
+            for (auto &[k, v] : y) {
+                x.erase(k);
+            }
+        },
+        [](auto &x, auto &&y, unsigned t) { x.subtract(std::move(y), t); });
+}
+
+static void bench_ranges(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    BinaryTree<int64_t, int64_t> b;
+    fill(b, keys);
+    const int64_t top = (int64_t) n * 2;
+
+    // Windows of 100 keys at random places in the tree.
+    const int windows = 100;
+    const int64_t width = 200;
+    std::mt19937_64 rng(5);
+    std::vector<int64_t> starts(windows);
+    for (auto &s : starts) {
+        s = rng() % top;
+    }
+    printf("ranges: %zu keys, %d windows of %lld keys\n", n, windows, (long long) width / 2);
+    printf("%-22s %14s\n", "", "us/window");
+    int64_t check[2] = {0, 0};
+    auto start = bench_clock::now();
+    for (int64_t lo : starts) {
+        for (auto it = b.begin(); it != b.end() && it->first < lo + width; ++it) {
+            if (it->first >= lo) {
+                check[0] += it->second;
+            }
+        }
+    }
+    printf("%-22s %14.2f\n", "skip from begin()", seconds_since(start) * 1e6 / windows);
+    start = bench_clock::now();
+    for (int64_t lo : starts) {
+        for (const auto &[key, value] : b.range(lo, lo + width)) {
+            check[1] += value;
+        }
+    }
+    printf("%-22s %14.2f\n", "range(lo, hi)", seconds_since(start) * 1e6 / windows);
+    if (check[0] != check[1]) {
+        fprintf(stderr, "window sums disagree\n");
+    }
+
+    // Erasing a tenth of the keys from the middle.
+    BinaryTree<int64_t, int64_t> c = b;
+    int64_t lo = top / 2;
+    int64_t hi = lo + top / 10;
+    printf("%-22s %14s\n", "", "erase s");
+    start = bench_clock::now();
+    for (int64_t k = lo; k < hi; k += 2) {
+        b.erase(k);
+    }
+    printf("%-22s %14.4f\n", "erase(key) each", seconds_since(start));
+    start = bench_clock::now();
+    c.erase(c.lower_bound(lo), c.lower_bound(hi));
+    printf("%-22s %14.4f  height %d\n", "erase(first, last)", seconds_since(start), c.height());
+}
+
+static void bench_churn(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    BinaryTree<int64_t, int64_t> b;
+    std::map<int64_t, int64_t> m;
+    fill(b, keys);
+    fill(m, keys);
+
+    // Each round erases half the keys at random and puts new ones
+    // in their place, so the size stays at n.
+    const int rounds = 10;
+    std::vector<int64_t> probes(keys.begin(), keys.begin() + std::min<size_t>(n, 1000000));
+    std::mt19937_64 rng(11);
+    int64_t next = (int64_t) n * 2;
+    printf("churn: %zu keys, %zu erases and inserts a round\n", n, n / 2);
+    printf("%6s %8s %16s %16s\n", "round", "height", "BinaryTree ns", "std::map ns");
+    for (int round = 0; round <= rounds; ++round) {
+        if (round > 0) {
+            for (size_t i = 0; i < n / 2; ++i) {
+                size_t victim = rng() % n;
+                b.erase(keys[victim]);
+                m.erase(keys[victim]);
+                keys[victim] = next++;
+                b[keys[victim]] = keys[victim];
+                m[keys[victim]] = keys[victim];
+            }
+            std::shuffle(keys.begin(), keys.end(), rng);
+            std::copy(keys.begin(), keys.begin() + probes.size(), probes.begin());
+        }
+        auto start = bench_clock::now();
+        int64_t sum = 0;
+        for (int64_t k : probes) {
+            sum += *b.find(k);
+        }
+        double tree_ns = seconds_since(start) * 1e9 / probes.size();
+        start = bench_clock::now();
+        for (int64_t k : probes) {
+            sum -= m.find(k)->second;
+        }
+        double map_ns = seconds_since(start) * 1e9 / probes.size();
+        if (sum != 0) {
+            fprintf(stderr, "lookups disagree\n");
+        }
+        printf("%6d %8d %16.1f %16.1f\n", round, b.height(), tree_ns, map_ns);
+    }
+}
+
+// ns per find() over probes, which all hit.
+template <class Map, class Key>
+static double ns_per_find(const Map &m, const std::vector<Key> &probes)
+{
+    int64_t sum = 0;
+    auto start = bench_clock::now();
+    for (const Key &k : probes) {
+        sum += *m.find(k);
+    }
+    double ns = seconds_since(start) * 1e9 / probes.size();
+    if (sum != (int64_t) probes.size()) {
+        fprintf(stderr, "lookups missed\n");
+    }
+    return ns;
+}
+
+static void bench_compare(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    printf("compare: %zu keys, ns/lookup\n", n);
+
+    BinaryTree<int64_t, int64_t> numbers;
+    for (int64_t k : keys) {
+        numbers[k] = 1;
+    }
+    std::vector<int64_t> number_probes = keys;
+    std::shuffle(number_probes.begin(), number_probes.end(), std::default_random_engine{7});
+    printf("%-34s %10.1f\n", "int64", ns_per_find(numbers, number_probes));
+
+    for (const char *prefix : {"", "/srv/data/reports/2021/"}) {
+        BinaryTree<std::string, int64_t> words;
+        std::vector<std::string> probes;
+        for (int64_t k : keys) {
+            probes.push_back(prefix + std::to_string(k * 7919));
+            words[probes.back()] = 1;
+        }
+        std::shuffle(probes.begin(), probes.end(), std::default_random_engine{7});
+        std::string label = std::string("string \"") + prefix + "...\"";
+        printf("%-34s %10.1f\n", label.c_str(), ns_per_find(words, probes));
+    }
+}
+
+static void bench_persist(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    BinaryTree<std::string, int> b;
+    for (int64_t k : keys) {
+        b["/srv/data/" + std::to_string(k * 7919)] = (int) k;
+    }
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::filesystem::path text = dir / "treebench_persist.txt";
+    std::filesystem::path binary = dir / "treebench_persist.bin";
+    printf("persist: %zu string keys\n", n);
+    printf("%-22s %10s %10s %10s\n", "", "write s", "read s", "MB");
+
+    auto start = bench_clock::now();
+    {
+        std::ofstream out(text);
+        for (const auto &[key, value] : b) {
+            out << key << '\t' << value << '\n';
+        }
+    }
+    double write = seconds_since(start);
+    start = bench_clock::now();
+    {
+        BinaryTree<std::string, int> t;
+        std::ifstream in(text);
+        std::string key;
+        int value;
+        while (in >> key >> value) {
+            t[key] = value;
+        }
+        printf("%-22s %10.3f %10.3f %10.1f\n", "text, operator[]", write, seconds_since(start),
+               std::filesystem::file_size(text) / 1048576.0);
+    }
+
+    start = bench_clock::now();
+    if (!b.save(binary)) {
+        fprintf(stderr, "save failed\n");
+    }
+    write = seconds_since(start);
+    start = bench_clock::now();
+    {
+        BinaryTree<std::string, int> t;
+        if (!t.load(binary)) {
+            fprintf(stderr, "load failed\n");
+        }
+        printf("%-22s %10.3f %10.3f %10.1f\n", "save(), load()", write, seconds_since(start),
+               std::filesystem::file_size(binary) / 1048576.0);
+    }
+    std::filesystem::remove(text);
+    std::filesystem::remove(binary);
+}
+
+static size_t heap_in_use()
+{
+    // Big blocks come straight from mmap and are only counted in
+    // hblkhd.
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Seconds to look up every key in probes, and how many were found.
+template <class Map>
+static std::pair<double, size_t> time_finds(const Map &m, const std::vector<int64_t> &probes)
+{
+    size_t found = 0;
+    auto start = bench_clock::now();
+    for (int64_t k : probes) {
+        found += m.find(k) != nullptr;
+    }
+    return {seconds_since(start), found};
+}
+
+static void bench_freeze(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    std::vector<int64_t> hits = keys, misses(n);
+    std::shuffle(hits.begin(), hits.end(), std::default_random_engine{7});
+    for (size_t i = 0; i < n; ++i) {
+        misses[i] = hits[i] + 1;
+    }
+
+    size_t before = heap_in_use();
+    BinaryTree<int64_t, int64_t> b;
+    fill(b, keys);
+    size_t tree_bytes = heap_in_use() - before;
+    auto start = bench_clock::now();
+    FrozenBinaryTree<int64_t, int64_t> frozen = b.freeze();
+    double freeze_time = seconds_since(start);
+
+    printf("freeze: %zu keys, froze in %.3f s\n", n, freeze_time);
+    printf("%-12s %12s %14s %14s\n", "", "heap MB", "hits/s", "misses/s");
+    auto row = [&](const char *label, const auto &m, size_t bytes) {
+        auto [hit_time, found] = time_finds(m, hits);
+        auto [miss_time, wrong] = time_finds(m, misses);
+        if (found != n || wrong != 0) {
+            fprintf(stderr, "%s: wrong lookup results\n", label);
+        }
+        printf("%-12s %12.1f %14.0f %14.0f\n", label, bytes / 1048576.0, n / hit_time, n / miss_time);
+    };
+    row("BinaryTree", b, tree_bytes);
+    row("frozen", frozen, frozen.memory_used());
+}
+
+// BinaryTree shared the only way it can be, behind a lock.  With
+// Shared set readers take it shared, which is safe since find()
+// doesn't change the tree.
+template <class Mutex, bool Shared>
+struct locked_tree {
+    BinaryTree<int64_t, int64_t> b;
+    mutable Mutex m;
+
+    bool contains(int64_t k) const
+    {
+        if constexpr (Shared) {
+            std::shared_lock<Mutex> g(m);
+            return b.contains(k);
+        } else {
+            std::lock_guard<Mutex> g(m);
+            return b.contains(k);
+        }
+    }
+    void insert(int64_t k, int64_t v)
+    {
+        std::lock_guard<Mutex> g(m);
+        b[k] = v;
+    }
+    void erase(int64_t k)
+    {
+        std::lock_guard<Mutex> g(m);
+        b.erase(k);
+    }
+};
+
+struct concurrent_tree {
+    ConcurrentBinaryTree<int64_t, int64_t> c;
+
+    bool contains(int64_t k) const { return c.contains(k); }
+    void insert(int64_t k, int64_t v) { c.insert(k, v); }
+    void erase(int64_t k) { c.erase(k); }
+};
+
+// Total ops/s from threads threads for a fixed time, each op a write
+// write_percent times in 100 and otherwise a lookup.  Writes insert or
+// erase keys in [0, 2n), half of which start out present.
+template <class Tree>
+static double mixed_throughput(Tree &t, size_t n, int threads, int write_percent)
+{
+    std::atomic<bool> done{false};
+    std::atomic<long> ops{0};
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; ++w) {
+        workers.emplace_back([&, w]() {
+            std::minstd_rand rng(w + 1);
+            long count = 0;
+            size_t found = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 64; ++i) {
+                    int64_t k = rng() % (n * 2);
+                    if ((int) (rng() % 100) < write_percent) {
+                        if (rng() % 2) {
+                            t.insert(k, k);
+                        } else {
+                            t.erase(k);
+                        }
+                    } else {
+                        found += t.contains(k);
+                    }
+                }
+                count += 64;
+            }
+            if (found == 0) {
+                fprintf(stderr, "no lookup hit\n");
+            }
+            ops += count;
+        });
+    }
+    auto start = bench_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    done = true;
+    for (auto &th : workers) {
+        th.join();
+    }
+    return ops.load() / seconds_since(start);
+}
+
+static void bench_persistent(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    printf("persistent: %zu keys\n", n);
+
+    auto start = bench_clock::now();
+    BinaryTree<int64_t, int64_t> b;
+    fill(b, keys);
+    printf("%-34s %12.0f ns\n", "BinaryTree insert", seconds_since(start) * 1e9 / n);
+    size_t heap_before = heap_in_use();
+    start = bench_clock::now();
+    PersistentBinaryTree<int64_t, int64_t> p;
+    for (int64_t k : keys) {
+        p = p.insert(k, k);
+    }
+    printf("%-34s %12.0f ns\n", "PersistentBinaryTree insert", seconds_since(start) * 1e9 / n);
+    printf("%-34s %12.1f bytes\n", "  heap per entry", double(heap_in_use() - heap_before) / n);
+
+    // Updates to existing keys, every version kept, then the same
+    // with only the latest kept.  The base version is held all along,
+    // so the second figure is what the latest no longer shares.
+    const size_t updates = std::min<size_t>(n, 200000);
+    std::mt19937_64 rng(13);
+    for (bool keep : {true, false}) {
+        std::vector<PersistentBinaryTree<int64_t, int64_t>> history;
+        history.reserve(keep ? updates : 0);
+        PersistentBinaryTree<int64_t, int64_t> version = p;
+        heap_before = heap_in_use();
+        start = bench_clock::now();
+        for (size_t i = 0; i < updates; ++i) {
+            version = version.insert(keys[rng() % n], (int64_t) i);
+            if (keep) {
+                history.push_back(version);
+            }
+        }
+        double elapsed = seconds_since(start);
+        printf("%-34s %12.0f ns %10.1f bytes/update\n", keep ? "update, keeping every version" : "update, keeping base and latest",
+               elapsed * 1e9 / updates, double(heap_in_use() - heap_before) / updates);
+    }
+
+    const int snapshots = 1000000;
+    start = bench_clock::now();
+    int64_t sizes = 0;
+    for (int i = 0; i < snapshots; ++i) {
+        PersistentBinaryTree<int64_t, int64_t> snapshot = p;
+        sizes += snapshot.size();
+    }
+    printf("%-34s %12.1f ns\n", "snapshot, PersistentBinaryTree", seconds_since(start) * 1e9 / snapshots);
+    start = bench_clock::now();
+    {
+        BinaryTree<int64_t, int64_t> copy = b;
+        sizes += copy.height();
+    }
+    printf("%-34s %12.1f ms\n", "snapshot, BinaryTree copy", seconds_since(start) * 1e3);
+    if (sizes == 0) {
+        fprintf(stderr, "empty snapshots\n");
+    }
+}
+
+// Random inserts, a lookup of every key, a full walk and erasing
+// half the keys.  Returns the seconds taken and a checksum.
+template <class Tree>
+static std::pair<double, int64_t> workload(Tree &t, const std::vector<int64_t> &keys)
+{
+    int64_t sum = 0;
+    auto start = bench_clock::now();
+    fill(t, keys);
+    for (int64_t k : keys) {
+        sum += *t.find(k);
+    }
+    sum += walk(t);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        t.erase(keys[i]);
+    }
+    return {seconds_since(start), sum};
+}
+
+static void bench_stats(size_t n)
+{
+    std::vector<int64_t> keys = make_keys(n);
+    printf("stats: %zu keys, insert, find, walk, erase half\n", n);
+    BinaryTree<int64_t, int64_t> plain;
+    auto [plain_time, plain_sum] = workload(plain, keys);
+    BinaryTree<int64_t, int64_t, BinaryTreeCompare<int64_t>, std::allocator<std::pair<const int64_t, int64_t>>,
+               BinaryTreeStats>
+        counted;
+    auto [counted_time, counted_sum] = workload(counted, keys);
+    if (plain_sum != counted_sum) {
+        fprintf(stderr, "workloads disagree\n");
+    }
+    printf("%-22s %10.3f s\n", "BinaryTreeNoStats", plain_time);
+    printf("%-22s %10.3f s\n", "BinaryTreeStats", counted_time);
+    printf("%s\n", counted.stats_json().c_str());
+}
+
+static void bench_concurrent(size_t n)
+{
+    // Writes are as likely to add a key as remove one, so the trees
+    // stay about half full from run to run.
+    std::vector<int64_t> keys = make_keys(n);
+    locked_tree<std::mutex, false> plain;
+    locked_tree<std::shared_mutex, true> shared;
+    concurrent_tree concurrent;
+    for (int64_t k : keys) {
+        plain.insert(k, k);
+        shared.insert(k, k);
+        concurrent.insert(k, k);
+    }
+    printf("concurrent: %zu keys, total ops/s\n", n);
+    for (int write_percent : {5, 50}) {
+        printf("%d%% writes\n", write_percent);
+        printf("%8s %14s %14s %14s\n", "threads", "mutex", "shared_mutex", "concurrent");
+        for (int threads = 1; threads <= 64; threads *= 2) {
+            double a = mixed_throughput(plain, n, threads, write_percent);
+            double b = mixed_throughput(shared, n, threads, write_percent);
+            double c = mixed_throughput(concurrent, n, threads, write_percent);
+            printf("%8d %14.0f %14.0f %14.0f\n", threads, a, b, c);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string which = argc > 1 ? argv[1] : "all";
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    if (which == "all" || which == "iterate") {
+        bench_iterate(n);
+    }
+    if (which == "all" || which == "scan") {
+        bench_scan(n);
+    }
+    if (which == "all" || which == "alloc") {
+        bench_alloc(n);
+    }
+    if (which == "all" || which == "bulk") {
+        bench_bulk(n);
+    }
+    if (which == "all" || which == "setops") {
+        bench_setops(n);
+    }
+    if (which == "all" || which == "freeze") {
+        bench_freeze(n);
+    }
+    if (which == "all" || which == "ranges") {
+        bench_ranges(n);
+    }
+    if (which == "all" || which == "churn") {
+        bench_churn(n);
+    }
+    if (which == "all" || which == "compare") {
+        bench_compare(n);
+    }
+    if (which == "all" || which == "persist") {
+        bench_persist(n);
+    }
+    if (which == "all" || which == "persistent") {
+        bench_persistent(n);
+    }
+    if (which == "all" || which == "stats") {
+        bench_stats(n);
+    }
+    if (which == "all" || which == "concurrent") {
+        bench_concurrent(n);
+    }
+    return 0;
+}
@@ -1,7 +1,14 @@
 #include <gtest/gtest.h>
 #include <string>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory_resource>
 #include <random>
+#include <thread>
 #include <ranges>
 #include "tree.hpp"
 
@@ -53,3 +60,1080 @@ TEST(TreeTest, BasicTests)
     EXPECT_EQ(b["baz"], 62);
 }
 
+
+TEST(TreeTest, Height)
+{
+    BinaryTree<int, int> b;
+    EXPECT_EQ(b.height(), 0);
+    for (int i = 0; i < 1023; ++i)
+    {
+        b[i] = i;
+    }
+    // A perfectly balanced tree of 1023 nodes has 10 levels; AVL allows
+    // at most about 1.44 log2(n).
+    EXPECT_GE(b.height(), 10);
+    EXPECT_LE(b.height(), 14);
+}
+
+TEST(TreeTest, FindDoesNotInsert)
+{
+    BinaryTree<std::string, int> b;
+    for (int i = 0; i < 100; ++i)
+    {
+        b[std::to_string(i)] = i;
+    }
+    int height = b.height();
+
+    EXPECT_EQ(b.find(std::string("missing")), nullptr);
+    EXPECT_FALSE(b.contains(std::string("missing")));
+    ASSERT_NE(b.find(std::string("42")), nullptr);
+    EXPECT_EQ(*b.find(std::string("42")), 42);
+    *b.find(std::string("42")) = -42;
+    EXPECT_EQ(b["42"], -42);
+
+    // string_view and C strings are compared against the keys directly.
+    std::string_view view = "17";
+    EXPECT_EQ(*b.find(view), 17);
+    EXPECT_TRUE(b.contains("99"));
+    EXPECT_FALSE(b.contains(std::string_view("100")));
+
+    const auto &c = b;
+    static_assert(std::is_same_v<decltype(c.find(view)), const int *>);
+    EXPECT_EQ(*c.find("5"), 5);
+    EXPECT_EQ(c.find("nope"), nullptr);
+    EXPECT_EQ(b.height(), height);
+}
+
+TEST(TreeTest, Iterators)
+{
+    using Tree = BinaryTree<std::string, int>;
+    static_assert(std::bidirectional_iterator<Tree::iterator>);
+    static_assert(std::bidirectional_iterator<Tree::const_iterator>);
+    static_assert(std::ranges::bidirectional_range<Tree>);
+    static_assert(std::is_same_v<decltype(*std::declval<Tree::iterator>()), std::pair<const std::string, int> &>);
+    static_assert(std::is_same_v<decltype(*std::declval<Tree::const_iterator>()), const std::pair<const std::string, int> &>);
+
+    Tree b;
+    EXPECT_EQ(b.begin(), b.end());
+    std::vector<std::string> keys;
+    for (int i = 0; i < 200; ++i)
+    {
+        keys.push_back(std::to_string(i));
+    }
+    auto rng = std::default_random_engine{};
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (auto &k : keys)
+    {
+        b[k] = std::stoi(k);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // Dereferencing doesn't move the iterator, and hands back the
+    // pair inside the node rather than a copy.
+    auto it = b.begin();
+    EXPECT_EQ(&*it, &*it);
+    EXPECT_EQ(it->first, keys[0]);
+    EXPECT_EQ(&it->second, b.find(keys[0]));
+
+    std::vector<std::string> forward, backward;
+    for (auto &[key, value] : b)
+    {
+        forward.push_back(key);
+        value += 1000;
+    }
+    EXPECT_EQ(forward, keys);
+    for (auto i = b.end(); i != b.begin();)
+    {
+        --i;
+        backward.push_back(i->first);
+    }
+    std::reverse(backward.begin(), backward.end());
+    EXPECT_EQ(backward, keys);
+
+    // Postfix forms, and a round trip through end().
+    auto last = std::prev(b.end());
+    EXPECT_EQ(last->first, keys.back());
+    auto copy = last++;
+    EXPECT_EQ(last, b.end());
+    EXPECT_EQ(copy->first, keys.back());
+    EXPECT_EQ((--last)->first, keys.back());
+
+    const Tree &c = b;
+    Tree::const_iterator ci = b.begin();
+    EXPECT_EQ(ci, c.begin());
+    EXPECT_EQ(std::distance(c.begin(), c.end()), 200);
+    auto found = std::ranges::find_if(c, [](const auto &kv) { return kv.first == "42"; });
+    ASSERT_NE(found, c.end());
+    EXPECT_EQ(found->second, 1042);
+    auto values = c | std::views::values | std::views::reverse;
+    EXPECT_EQ(*values.begin(), std::stoi(keys.back()) + 1000);
+}
+
+TEST(TreeTest, ParentLinks)
+{
+    // An iterator is a single pointer; walking needs no memory.
+    static_assert(sizeof(BinaryTree<int, int>::iterator) == sizeof(void *));
+
+    // Iteration stays in step with std::map through inserts and
+    // erases, which move nodes and rotate subtrees.
+    BinaryTree<int, int> b;
+    std::map<int, int> expected;
+    std::mt19937 rng(3);
+    for (int i = 0; i < 4000; ++i)
+    {
+        int k = rng() % 500;
+        if (rng() % 3 == 0)
+        {
+            b.erase(k);
+            expected.erase(k);
+        }
+        else
+        {
+            b[k] = i;
+            expected[k] = i;
+        }
+        if (i % 250 == 0)
+        {
+            EXPECT_TRUE(std::equal(b.begin(), b.end(), expected.begin(), expected.end()));
+            EXPECT_TRUE(std::equal(std::make_reverse_iterator(b.end()), std::make_reverse_iterator(b.begin()),
+                                   expected.rbegin(), expected.rend()));
+        }
+    }
+    EXPECT_TRUE(std::equal(b.begin(), b.end(), expected.begin(), expected.end()));
+    for (auto &[k, v] : expected)
+    {
+        b.erase(k);
+    }
+    EXPECT_EQ(b.begin(), b.end());
+}
+
+// Counts what goes through it so tests can see how the tree
+// allocates.
+static int allocations = 0;
+static long live_bytes = 0;
+
+template <class T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator() = default;
+    template <class U>
+    CountingAllocator(const CountingAllocator<U> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        allocations++;
+        live_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, std::size_t n)
+    {
+        live_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <class U>
+    bool operator==(const CountingAllocator<U> &) const { return true; }
+};
+
+TEST(TreeTest, Allocators)
+{
+    {
+        BinaryTree<int, std::string, BinaryTreeCompare<int>, CountingAllocator<std::pair<const int, std::string>>> b;
+        for (int i = 0; i < 10000; ++i)
+        {
+            b[i] = std::string(40, 'x');
+        }
+        // Nodes come out of slabs, not one call per node.
+        EXPECT_LT(allocations, 20);
+        EXPECT_GT(live_bytes, 0);
+        // Erased nodes are reused before the pool grows again.
+        int before = allocations;
+        for (int i = 0; i < 5000; ++i)
+        {
+            b.erase(i);
+        }
+        for (int i = 20000; i < 25000; ++i)
+        {
+            b[i] = "y";
+        }
+        EXPECT_EQ(allocations, before);
+        EXPECT_EQ(std::distance(b.begin(), b.end()), 10000);
+    }
+    EXPECT_EQ(live_bytes, 0);
+
+    // A tree in an arena that can't fall back on the heap.
+    std::vector<std::byte> buffer(1 << 20);
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+    {
+        pmr::BinaryTree<int, int> p(&arena);
+        EXPECT_EQ(p.get_allocator().resource(), &arena);
+        for (int i = 0; i < 1000; ++i)
+        {
+            p[i] = -i;
+        }
+        EXPECT_EQ(*p.find(999), -999);
+        EXPECT_EQ(std::distance(p.begin(), p.end()), 1000);
+    }
+}
+
+TEST(TreeTest, MoveAndNodeHandles)
+{
+    using Tree = BinaryTree<std::string, std::unique_ptr<int>>;
+    static_assert(std::is_nothrow_move_constructible_v<Tree>);
+
+    // Values are built in place, and only when the key is new.
+    Tree a;
+    auto value = std::make_unique<int>(1);
+    EXPECT_TRUE(a.try_emplace("one", std::move(value)).second);
+    EXPECT_EQ(value, nullptr);
+    value = std::make_unique<int>(9);
+    EXPECT_FALSE(a.try_emplace("one", std::move(value)).second);
+    EXPECT_NE(value, nullptr);
+    EXPECT_TRUE(a.emplace("two", std::make_unique<int>(2)).second);
+    EXPECT_FALSE(a.emplace("two", std::make_unique<int>(0)).second);
+    EXPECT_FALSE(a.insert_or_assign("two", std::make_unique<int>(22)).second);
+    EXPECT_TRUE(a.insert_or_assign(std::string("three"), std::make_unique<int>(3)).second);
+    EXPECT_EQ(**a.find("one"), 1);
+    EXPECT_EQ(**a.find("two"), 22);
+
+    // Moving hands the nodes over and leaves a usable empty tree.
+    auto *node = &*a.begin();
+    Tree b(std::move(a));
+    EXPECT_EQ(&*b.begin(), node);
+    EXPECT_EQ(a.begin(), a.end());
+    a.try_emplace("again", nullptr);
+    EXPECT_TRUE(a.contains("again"));
+    a = std::move(b);
+    EXPECT_EQ(std::distance(a.begin(), a.end()), 3);
+    std::vector<Tree> trees;
+    trees.push_back(std::move(a));
+    trees.emplace_back();
+    EXPECT_EQ(**trees[0].find("three"), 3);
+
+    // Entries move between trees in their nodes, and outlive the
+    // tree they came from.
+    Tree::node_type handle = trees[0].extract("three");
+    ASSERT_FALSE(handle.empty());
+    EXPECT_EQ(handle.key(), "three");
+    EXPECT_FALSE(trees[0].contains("three"));
+    int *held = handle.mapped().get();
+    trees.erase(trees.begin());
+    auto result = trees[0].insert(std::move(handle));
+    EXPECT_TRUE(result.inserted);
+    EXPECT_TRUE(handle.empty());
+    EXPECT_EQ(result.position->second.get(), held);
+    trees[0].try_emplace("four", std::make_unique<int>(4));
+    auto again = trees[0].insert(trees[0].extract("three"));
+    EXPECT_TRUE(again.inserted);
+    EXPECT_TRUE(trees[0].extract("missing").empty());
+    Tree c;
+    c.try_emplace("four", nullptr);
+    auto clash = c.insert(trees[0].extract("four"));
+    EXPECT_FALSE(clash.inserted);
+    EXPECT_EQ(*clash.node.mapped(), 4);
+
+    // An adopted node can be handed on again after its first tree
+    // and the one it went to are both gone.
+    {
+        Tree d;
+        d.insert(std::move(clash.node));
+        handle = d.extract("four");
+        c.clear();
+    }
+    EXPECT_EQ(*handle.mapped(), 4);
+
+    // Copies are deep.
+    BinaryTree<std::string, int> e;
+    for (int i = 0; i < 100; ++i)
+    {
+        e[std::to_string(i)] = i;
+    }
+    BinaryTree<std::string, int> f(e);
+    e["5"] = -5;
+    EXPECT_EQ(*f.find("5"), 5);
+    EXPECT_EQ(f.height(), e.height());
+    EXPECT_TRUE(std::equal(std::next(e.begin(), 50), e.end(), std::next(f.begin(), 50), f.end()));
+    f = e;
+    EXPECT_EQ(*f.find("5"), -5);
+    f = f;
+    EXPECT_EQ(std::distance(f.begin(), f.end()), 100);
+
+    // pmr trees on different resources can't swap nodes, so the
+    // entries are moved across.
+    std::pmr::monotonic_buffer_resource one, two;
+    pmr::BinaryTree<int, std::pmr::string> g(&one), h(&two);
+    g.try_emplace(1, "a string too long to fit in place");
+    h = std::move(g);
+    EXPECT_EQ(h.get_allocator().resource(), &two);
+    EXPECT_EQ(*h.find(1), "a string too long to fit in place");
+    EXPECT_EQ(g.begin(), g.end());
+}
+
+// The height of the tree, or -1 if it is taller than an AVL tree
+// with that many keys can be (1.45 log2(n + 2)).
+template <class Tree>
+static int avl_height(const Tree &b)
+{
+    auto n = std::distance(b.begin(), b.end());
+    int height = const_cast<Tree &>(b).height();
+    return height <= 1.45 * std::log2(n + 2) ? height : -1;
+}
+
+TEST(TreeTest, BulkAndSetOperations)
+{
+    std::vector<std::pair<int, int>> sorted;
+    for (int i = 0; i < 1000; ++i)
+    {
+        sorted.emplace_back(i * 2, i);
+    }
+    BinaryTree<int, int> built(sorted.begin(), sorted.end());
+    EXPECT_EQ(built.height(), 10);
+    EXPECT_TRUE(std::equal(built.begin(), built.end(), sorted.begin(), sorted.end(),
+                           [](auto &a, auto &b) { return a.first == b.first && a.second == b.second; }));
+
+    // Out of order input and repeated keys still work.
+    std::vector<std::pair<int, int>> messy = {{1, 1}, {3, 3}, {3, 4}, {2, 2}, {5, 5}, {0, 0}, {2, 9}};
+    BinaryTree<int, int> unsorted(messy.begin(), messy.end());
+    std::vector<int> keys;
+    for (auto &[k, v] : unsorted)
+    {
+        keys.push_back(k);
+    }
+    EXPECT_EQ(keys, (std::vector<int>{0, 1, 2, 3, 5}));
+    EXPECT_EQ(*unsorted.find(3), 3);
+    EXPECT_EQ(*unsorted.find(2), 2);
+
+    // Compare every operation against std::set_*, on one thread and
+    // on several with trees big enough to fork.
+    for (unsigned threads : {1u, 4u})
+    {
+        std::mt19937 rng(threads);
+        std::map<int, int> ma, mb;
+        BinaryTree<int, int> a, b;
+        for (int i = 0; i < 40000; ++i)
+        {
+            int k = rng() % 100000;
+            ma.try_emplace(k, 1);
+            a.try_emplace(k, 1);
+            k = rng() % 100000;
+            mb.try_emplace(k, 2);
+            b.try_emplace(k, 2);
+        }
+        auto check = [](const BinaryTree<int, int> &t, auto &&expected) {
+            EXPECT_TRUE(std::ranges::equal(t, expected));
+            EXPECT_NE(avl_height(t), -1);
+            EXPECT_TRUE(t.check_invariants());
+            // Walking back down from end() uses the parent links the
+            // operations rebuilt.
+            EXPECT_TRUE(std::ranges::equal(t | std::views::reverse, expected | std::views::reverse));
+        };
+
+        std::vector<std::pair<const int, int>> expected;
+        auto by_key = [](auto &x, auto &y) { return x.first < y.first; };
+        BinaryTree<int, int> u = a;
+        u.unite(b, threads);
+        std::set_union(ma.begin(), ma.end(), mb.begin(), mb.end(), std::back_inserter(expected), by_key);
+        check(u, std::map<int, int>(expected.begin(), expected.end()));
+        EXPECT_EQ(std::distance(b.begin(), b.end()), (long) mb.size());
+
+        expected.clear();
+        BinaryTree<int, int> i = a;
+        i.intersect(b, threads);
+        std::set_intersection(ma.begin(), ma.end(), mb.begin(), mb.end(), std::back_inserter(expected), by_key);
+        check(i, std::map<int, int>(expected.begin(), expected.end()));
+
+        expected.clear();
+        BinaryTree<int, int> d = a;
+        d.subtract(std::move(b), threads);
+        EXPECT_EQ(b.begin(), b.end());
+        std::set_difference(ma.begin(), ma.end(), mb.begin(), mb.end(), std::back_inserter(expected), by_key);
+        check(d, std::map<int, int>(expected.begin(), expected.end()));
+
+        BinaryTree<int, int> upper = a.split(50000);
+        check(a, std::map<int, int>(ma.begin(), ma.lower_bound(50000)));
+        check(upper, std::map<int, int>(ma.lower_bound(50000), ma.end()));
+        a.unite(std::move(upper));
+        check(a, ma);
+    }
+}
+
+TEST(TreeTest, BalanceAfterErase)
+{
+    // Inserting in order then erasing everything but the ends is what
+    // used to leave long spines behind.
+    BinaryTree<int, int> b;
+    for (int i = 0; i < 4096; ++i)
+    {
+        b[i] = i;
+        ASSERT_TRUE(b.check_invariants());
+    }
+    EXPECT_EQ(b.height(), 13);
+    for (int i = 1; i < 4095; ++i)
+    {
+        b.erase(i);
+        ASSERT_TRUE(b.check_invariants());
+    }
+    EXPECT_EQ(b.height(), 2);
+
+    // Random churn against std::map.
+    std::mt19937 rng(3);
+    std::map<int, int> expected = {{0, 0}, {4095, 4095}};
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int i = 0; i < 2000; ++i)
+        {
+            int k = rng() % 5000;
+            if (rng() % 2)
+            {
+                b[k] = k;
+                expected[k] = k;
+            }
+            else
+            {
+                b.erase(k);
+                expected.erase(k);
+            }
+        }
+        ASSERT_TRUE(b.check_invariants());
+        EXPECT_NE(avl_height(b), -1);
+        EXPECT_TRUE(std::ranges::equal(b, expected));
+    }
+
+    // Extracting and putting nodes back goes through the same paths.
+    for (int k = 0; k < 5000; k += 7)
+    {
+        auto node = b.extract(k);
+        if (node)
+        {
+            b.insert(std::move(node));
+        }
+    }
+    EXPECT_TRUE(b.check_invariants());
+    EXPECT_TRUE(std::ranges::equal(b, expected));
+}
+
+TEST(TreeTest, RangeQueries)
+{
+    std::map<int, int> expected;
+    BinaryTree<int, int> b;
+    for (int i = 0; i < 500; ++i)
+    {
+        expected[i * 3] = i;
+        b[i * 3] = i;
+    }
+    const BinaryTree<int, int> &cb = b;
+    for (int k = -2; k < 1505; ++k)
+    {
+        auto lower = expected.lower_bound(k);
+        auto upper = expected.upper_bound(k);
+        EXPECT_EQ(b.lower_bound(k) == b.end(), lower == expected.end());
+        EXPECT_EQ(cb.upper_bound(k) == cb.end(), upper == expected.end());
+        if (lower != expected.end())
+        {
+            EXPECT_EQ(b.lower_bound(k)->first, lower->first);
+        }
+        if (upper != expected.end())
+        {
+            EXPECT_EQ(cb.upper_bound(k)->first, upper->first);
+        }
+        auto [first, last] = b.equal_range(k);
+        EXPECT_EQ(std::distance(first, last), (long) expected.count(k));
+    }
+
+    auto window = b.range(100, 200);
+    EXPECT_TRUE(std::ranges::equal(window, std::ranges::subrange(expected.lower_bound(100), expected.lower_bound(200))));
+    EXPECT_TRUE(cb.range(7, 7).empty());
+    EXPECT_TRUE(cb.range(2000, 3000).empty());
+
+    // Erasing a range, a single entry, and everything to the end.
+    auto next = b.erase(b.lower_bound(100), b.lower_bound(1000));
+    expected.erase(expected.lower_bound(100), expected.lower_bound(1000));
+    EXPECT_EQ(next->first, 1002);
+    EXPECT_TRUE(std::ranges::equal(b, expected));
+    EXPECT_NE(avl_height(b), -1);
+    EXPECT_TRUE(std::ranges::equal(b | std::views::reverse, expected | std::views::reverse));
+    EXPECT_TRUE(b.check_invariants());
+
+    next = b.erase(b.lower_bound(0));
+    expected.erase(0);
+    EXPECT_EQ(next->first, 3);
+    EXPECT_EQ(b.erase(b.lower_bound(50), b.lower_bound(50)), b.lower_bound(50));
+
+    next = b.erase(b.lower_bound(1200), b.end());
+    expected.erase(expected.lower_bound(1200), expected.end());
+    EXPECT_EQ(next, b.end());
+    EXPECT_TRUE(std::ranges::equal(b, expected));
+    EXPECT_EQ((--b.end())->first, 1197);
+
+    b.erase(b.begin(), b.end());
+    EXPECT_EQ(b.begin(), b.end());
+    b[5] = 5;
+    EXPECT_EQ(b.lower_bound(0)->first, 5);
+}
+
+TEST(TreeTest, Freeze)
+{
+    // Every size up to a few full levels, so the last level is at
+    // every stage of filling up.
+    for (int n = 0; n < 70; ++n)
+    {
+        BinaryTree<int, int> b;
+        std::vector<int> keys;
+        for (int i = 0; i < n; ++i)
+        {
+            keys.push_back(i * 2);
+        }
+        std::shuffle(keys.begin(), keys.end(), std::default_random_engine(n));
+        for (int k : keys)
+        {
+            b[k] = -k;
+        }
+        auto frozen = b.freeze();
+        EXPECT_EQ(frozen.size(), (size_t) n);
+        for (int k = -1; k <= 2 * n; ++k)
+        {
+            const int *v = frozen.find(k);
+            if (k >= 0 && k % 2 == 0 && k < 2 * n)
+            {
+                ASSERT_NE(v, nullptr);
+                EXPECT_EQ(*v, -k);
+            }
+            else
+            {
+                EXPECT_EQ(v, nullptr);
+            }
+        }
+        std::vector<std::pair<int, int>> forward, backward;
+        for (auto [k, v] : frozen)
+        {
+            forward.emplace_back(k, v);
+        }
+        for (auto it = frozen.end(); it != frozen.begin();)
+        {
+            --it;
+            backward.emplace_back((*it).first, (*it).second);
+        }
+        std::reverse(backward.begin(), backward.end());
+        std::vector<std::pair<int, int>> expected(b.begin(), b.end());
+        EXPECT_EQ(forward, expected);
+        EXPECT_EQ(backward, expected);
+    }
+
+    // Looking up by string_view, and the snapshot doesn't follow
+    // the tree.
+    BinaryTree<std::string, std::string> s;
+    s["apple"] = "red";
+    s["banana"] = "yellow";
+    auto frozen = s.freeze();
+    s["apple"] = "green";
+    EXPECT_EQ(*frozen.find(std::string_view("apple")), "red");
+    EXPECT_TRUE(frozen.contains("banana"));
+    EXPECT_FALSE(frozen.contains("cherry"));
+    static_assert(std::bidirectional_iterator<decltype(frozen.begin())>);
+    EXPECT_EQ(std::ranges::distance(frozen), 2);
+}
+
+// A value whose copies start throwing once copies_left runs out
+// (never, while it is negative).
+struct Touchy
+{
+    static inline int copies_left = -1;
+    int v = 0;
+    Touchy(int vin) : v(vin) {}
+    Touchy(const Touchy &other) : v(other.v)
+    {
+        if (copies_left == 0)
+        {
+            throw std::runtime_error("copy");
+        }
+        copies_left--;
+    }
+};
+
+// Largest first.
+struct Descending
+{
+    template <class A, class B>
+    auto operator()(const A &a, const B &b) const
+    {
+        return b <=> a;
+    }
+};
+
+// Ignores case, and counts the comparisons the tree makes.
+struct CaseInsensitive
+{
+    static inline int calls = 0;
+
+    std::weak_ordering operator()(std::string_view a, std::string_view b) const
+    {
+        calls++;
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+        {
+            int x = std::tolower((unsigned char) a[i]);
+            int y = std::tolower((unsigned char) b[i]);
+            if (x != y)
+            {
+                return x <=> y;
+            }
+        }
+        return a.size() <=> b.size();
+    }
+};
+
+// A key with only <, which the default ordering builds on.
+struct LessOnly
+{
+    int value;
+
+    bool operator<(const LessOnly &other) const
+    {
+        return value < other.value;
+    }
+};
+
+TEST(TreeTest, CustomOrder)
+{
+    BinaryTree<int, int, Descending> down;
+    for (int i = 0; i < 100; ++i)
+    {
+        down[i] = i;
+    }
+    EXPECT_TRUE(down.check_invariants());
+    EXPECT_EQ(down.begin()->first, 99);
+    EXPECT_EQ((--down.end())->first, 0);
+    EXPECT_EQ(down.lower_bound(50)->first, 50);
+    EXPECT_EQ(down.upper_bound(50)->first, 49);
+    std::vector<int> window;
+    for (auto &[k, v] : down.range(20, 15))
+    {
+        window.push_back(k);
+    }
+    EXPECT_EQ(window, (std::vector<int>{20, 19, 18, 17, 16}));
+    down.erase(down.lower_bound(90), down.lower_bound(10));
+    EXPECT_EQ(std::distance(down.begin(), down.end()), 20);
+
+    BinaryTree<int, int, Descending> evens;
+    for (int i = 0; i < 100; i += 2)
+    {
+        evens[i] = -i;
+    }
+    down.intersect(evens);
+    EXPECT_TRUE(down.check_invariants());
+    EXPECT_EQ(std::distance(down.begin(), down.end()), 10);
+    EXPECT_EQ(down.begin()->first, 98);
+    auto frozen = down.freeze();
+    EXPECT_EQ((*frozen.begin()).first, 98);
+    EXPECT_EQ(*frozen.find(4), 4);
+    EXPECT_FALSE(frozen.contains(5));
+    BinaryTree<int, int, Descending> high = down.split(50);
+    EXPECT_EQ(high.begin()->first, 10);
+    EXPECT_EQ((--down.end())->first, 92);
+
+    BinaryTree<std::string, int, CaseInsensitive> words;
+    words["Apple"] = 1;
+    words["banana"] = 2;
+    words["CHERRY"] = 3;
+    EXPECT_EQ(words["APPLE"], 1);
+    EXPECT_EQ(std::distance(words.begin(), words.end()), 3);
+    EXPECT_TRUE(words.contains(std::string("Banana")));
+    words.erase("cherry");
+    EXPECT_FALSE(words.contains(std::string("Cherry")));
+
+    // One comparison per level on the way down.
+    for (int i = 0; i < 1000; ++i)
+    {
+        words["key" + std::to_string(i)] = i;
+    }
+    CaseInsensitive::calls = 0;
+    EXPECT_NE(words.find(std::string("KEY500")), nullptr);
+    EXPECT_LE(CaseInsensitive::calls, words.height());
+
+    BinaryTree<LessOnly, int> plain;
+    for (int i : {5, 3, 8, 1, 4})
+    {
+        plain[LessOnly{i}] = i;
+    }
+    EXPECT_EQ(plain.begin()->first.value, 1);
+    EXPECT_EQ(*plain.find(LessOnly{4}), 4);
+    EXPECT_TRUE(plain.check_invariants());
+}
+
+TEST(TreeTest, SaveAndLoad)
+{
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "tree_test_save.bin";
+    BinaryTree<std::string, int> b;
+    for (int i = 0; i < 5000; ++i)
+    {
+        b["key " + std::to_string(i * 7)] = i;
+    }
+    b[std::string(300, 'x')] = -1;
+    b[""] = 0;
+    ASSERT_TRUE(b.save(path));
+
+    BinaryTree<std::string, int> c;
+    c["stale"] = 1;
+    ASSERT_TRUE(c.load(path));
+    EXPECT_TRUE(std::ranges::equal(b, c));
+    EXPECT_TRUE(c.check_invariants());
+    EXPECT_LE(c.height(), 14);
+    EXPECT_FALSE(c.contains(std::string("stale")));
+
+    // Numbers, and an empty tree.
+    std::filesystem::path numbers = path;
+    numbers += ".numbers";
+    BinaryTree<int64_t, double> d;
+    for (int i = 0; i < 100; ++i)
+    {
+        d[i * i] = i / 4.0;
+    }
+    ASSERT_TRUE(d.save(numbers));
+    BinaryTree<int64_t, double> e;
+    ASSERT_TRUE(e.load(numbers));
+    EXPECT_TRUE(std::ranges::equal(d, e));
+    {
+        // Flipping the sign of two values, the top bit of two words,
+        // doesn't slip past the checksum.
+        std::string saved;
+        {
+            std::ifstream in(numbers, std::ios::binary);
+            saved.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        size_t values = sizeof(BinaryTreeFile::Header) + sizeof(int64_t);
+        saved[values + 16 * 3 + 7] ^= 0x80;
+        saved[values + 16 * 10 + 7] ^= 0x80;
+        std::ofstream(numbers, std::ios::binary | std::ios::trunc).write(saved.data(), saved.size());
+        EXPECT_FALSE(e.load(numbers));
+        EXPECT_TRUE(std::ranges::equal(d, e));
+    }
+    ASSERT_TRUE((BinaryTree<int64_t, double>().save(numbers)));
+    ASSERT_TRUE(e.load(numbers));
+    EXPECT_EQ(e.begin(), e.end());
+
+    // Files of another type, or that don't match the checksum or their
+    // length, are turned down and the tree keeps what it had.
+    BinaryTree<int64_t, int64_t> wrong_type;
+    EXPECT_FALSE(wrong_type.load(path));
+    EXPECT_FALSE(c.load(path.string() + ".missing"));
+    std::string bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto rewrite = [&](const std::string &contents) {
+        std::ofstream out(numbers, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+    };
+    std::string flipped = bytes;
+    flipped[flipped.size() / 2] ^= 0x10;
+    rewrite(flipped);
+    EXPECT_FALSE(c.load(numbers));
+    rewrite(bytes.substr(0, bytes.size() - 1));
+    EXPECT_FALSE(c.load(numbers));
+    std::string newer = bytes;
+    newer[8] = 2;
+    rewrite(newer);
+    EXPECT_FALSE(c.load(numbers));
+    rewrite(bytes);
+    EXPECT_TRUE(c.load(numbers));
+    EXPECT_TRUE(std::ranges::equal(b, c));
+
+    // A bool is a 0 or 1 byte.  Any other byte is turned down, even
+    // under a checksum that matches it.
+    BinaryTree<int, bool> flags;
+    for (int i = 0; i < 10; ++i)
+    {
+        flags[i] = i % 3 == 0;
+    }
+    ASSERT_TRUE(flags.save(numbers));
+    BinaryTree<int, bool> flags_back;
+    ASSERT_TRUE(flags_back.load(numbers));
+    EXPECT_TRUE(std::ranges::equal(flags, flags_back));
+    {
+        std::string saved;
+        {
+            std::ifstream in(numbers, std::ios::binary);
+            saved.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        BinaryTreeFile::Header header;
+        std::memcpy(&header, saved.data(), sizeof(header));
+        saved[sizeof(header) + sizeof(int)] = 2;
+        header.checksum = BinaryTreeFile::checksum(saved.data() + sizeof(header), header.length);
+        std::memcpy(saved.data(), &header, sizeof(header));
+        rewrite(saved);
+        EXPECT_FALSE(flags_back.load(numbers));
+        EXPECT_TRUE(std::ranges::equal(flags, flags_back));
+    }
+
+    // Keys are checked against the tree's own order.
+    BinaryTree<std::string, int, Descending> backwards;
+    EXPECT_FALSE(backwards.load(path));
+    EXPECT_EQ(backwards.begin(), backwards.end());
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(numbers);
+}
+
+TEST(TreeTest, Stats)
+{
+    // The default policy costs nothing in size.
+    static_assert(sizeof(BinaryTree<int, int>::iterator) == sizeof(void *));
+
+    using Counted = BinaryTree<int, int, BinaryTreeCompare<int>, std::allocator<std::pair<const int, int>>, BinaryTreeStats>;
+    Counted b;
+    for (int i = 0; i < 1023; ++i)
+    {
+        b[i] = i;
+    }
+    const BinaryTreeStats &stats = b.stats();
+    EXPECT_EQ(stats.allocations, 1023u);
+    // Keys in order only ever lean right.
+    EXPECT_GT(stats.rotations[int(BinaryTreeRotation::left)], 0u);
+    EXPECT_EQ(stats.rotations[int(BinaryTreeRotation::right)], 0u);
+    EXPECT_EQ(stats.rotations[int(BinaryTreeRotation::left_right)], 0u);
+    EXPECT_EQ(stats.rotations[int(BinaryTreeRotation::right_left)], 0u);
+
+    b.stats() = BinaryTreeStats();
+    EXPECT_EQ(*b.find(700), 700);
+    EXPECT_GT(stats.comparisons, 0u);
+    EXPECT_LE(stats.comparisons, (uint64_t) b.height());
+
+    b.stats() = BinaryTreeStats();
+    long sum = 0;
+    for (auto &[k, v] : b)
+    {
+        sum += v;
+    }
+    EXPECT_EQ(sum, 1022 * 1023 / 2);
+    EXPECT_EQ(stats.iterator_steps, 1023u);
+    EXPECT_LE(stats.iterator_links, 2u * 1023);
+    EXPECT_LE(stats.iterator_max_links, b.height());
+
+    // Erasing from the left makes the tree lean right, the other way.
+    b.stats() = BinaryTreeStats();
+    for (int i = 0; i < 600; ++i)
+    {
+        b.erase(i);
+    }
+    EXPECT_GT(stats.rotations[int(BinaryTreeRotation::left)] + stats.rotations[int(BinaryTreeRotation::right_left)], 0u);
+
+    std::string json = b.stats_json();
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_EQ(json.back(), '}');
+    EXPECT_NE(json.find("\"comparisons\": "), std::string::npos);
+    EXPECT_NE(json.find("\"left_right\": "), std::string::npos);
+    EXPECT_NE(json.find("\"height\": " + std::to_string(b.height())), std::string::npos);
+    EXPECT_NE(json.find("\"depths\": [1, 2, "), std::string::npos);
+
+    // Copies count their own allocations.
+    Counted c = b;
+    EXPECT_EQ(c.stats().allocations, 423u);
+
+    // Set operations on trees tall enough to split over threads still
+    // count on one, and come to the same totals however many threads
+    // they are offered.
+    auto united = [](unsigned threads) {
+        Counted x, y;
+        for (int i = 0; i < 40000; ++i)
+        {
+            x[i * 2] = i;
+            y[i * 3] = i;
+        }
+        x.stats() = BinaryTreeStats();
+        x.unite(std::move(y), threads);
+        return x.stats();
+    };
+    BinaryTreeStats one = united(1);
+    BinaryTreeStats many = united(8);
+    EXPECT_GT(one.comparisons, 0u);
+    EXPECT_EQ(many.comparisons, one.comparisons);
+    EXPECT_TRUE(std::ranges::equal(many.rotations, one.rotations));
+}
+
+TEST(TreeTest, ConcurrentTree)
+{
+    // On one thread it behaves like a map, and stays balanced.
+    ConcurrentBinaryTree<int, int> c;
+    std::map<int, int> expected;
+    std::mt19937 rng(5);
+    for (int i = 0; i < 20000; ++i)
+    {
+        int k = rng() % 3000;
+        if (rng() % 3 == 0)
+        {
+            EXPECT_EQ(c.erase(k), expected.erase(k) == 1);
+        }
+        else
+        {
+            EXPECT_EQ(c.insert(k, i), expected.insert_or_assign(k, i).second);
+        }
+    }
+    EXPECT_EQ(c.size(), expected.size());
+    EXPECT_LE(c.height(), 1.45 * std::log2(expected.size() + 2));
+    std::vector<std::pair<int, int>> seen;
+    c.for_each([&](int k, int v) { seen.emplace_back(k, v); });
+    EXPECT_TRUE(std::ranges::equal(seen, expected, [](auto &a, auto &b) { return a.first == b.first && a.second == b.second; }));
+    EXPECT_EQ(c.lookup(-1), std::nullopt);
+
+    // Readers never miss the keys that stay put, or see a value that
+    // was never written, while writers churn the rest.
+    ConcurrentBinaryTree<int, std::string> shared;
+    for (int k = 0; k < 2000; k += 2)
+    {
+        shared.insert(k, std::to_string(k));
+    }
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < 2; ++w)
+    {
+        threads.emplace_back([&, w] {
+            std::mt19937 wrng(w);
+            for (int i = 0; i < 20000; ++i)
+            {
+                int k = (wrng() % 1000) * 2 + 1;
+                if (wrng() % 2)
+                {
+                    shared.insert(k, std::to_string(k));
+                }
+                else
+                {
+                    shared.erase(k);
+                }
+            }
+        });
+    }
+    for (int r = 0; r < 3; ++r)
+    {
+        threads.emplace_back([&, r] {
+            std::mt19937 rrng(100 + r);
+            while (!done)
+            {
+                int k = rrng() % 2000;
+                auto value = shared.lookup(k);
+                if ((k % 2 == 0 && !value) || (value && *value != std::to_string(k)))
+                {
+                    errors++;
+                }
+            }
+        });
+    }
+    threads[0].join();
+    threads[1].join();
+    done = true;
+    for (size_t i = 2; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+    EXPECT_EQ(errors, 0);
+    size_t count = 0;
+    shared.for_each([&](int k, const std::string &v) {
+        count++;
+        EXPECT_EQ(v, std::to_string(k));
+    });
+    EXPECT_EQ(count, shared.size());
+
+    // It takes a Compare like BinaryTree does.
+    ConcurrentBinaryTree<int, int, Descending> reversed;
+    for (int k = 0; k < 100; ++k)
+    {
+        reversed.insert(k, k);
+    }
+    EXPECT_TRUE(reversed.erase(50));
+    std::vector<int> keys;
+    reversed.for_each([&](int k, int) { keys.push_back(k); });
+    EXPECT_TRUE(std::ranges::is_sorted(keys, std::greater<int>()));
+    EXPECT_EQ(keys.size(), 99u);
+
+    // A copy that throws partway through a write leaves the tree as
+    // it was, with none of its nodes retired.  Under ASan, freeing
+    // nodes the tree still holds would show up at the end.
+    ConcurrentBinaryTree<int, Touchy> touchy;
+    for (int k = 0; k < 2000; ++k)
+    {
+        touchy.insert(k, Touchy(k));
+    }
+    int threw = 0;
+    for (int k = 0; k < 3000; ++k)
+    {
+        Touchy::copies_left = k % 8;
+        try
+        {
+            if (k % 2)
+            {
+                touchy.erase(k % 2000);
+            }
+            else
+            {
+                touchy.insert(k, Touchy(k));
+            }
+        }
+        catch (const std::runtime_error &)
+        {
+            threw++;
+        }
+    }
+    Touchy::copies_left = -1;
+    EXPECT_GT(threw, 0);
+    std::map<int, int> left;
+    touchy.for_each([&](int k, const Touchy &v) { left.emplace(k, v.v); });
+    EXPECT_EQ(left.size(), touchy.size());
+    for (auto &[k, v] : left)
+    {
+        EXPECT_EQ(k, v);
+    }
+}
+
+TEST(TreeTest, PersistentTree)
+{
+    PersistentBinaryTree<int, std::string> empty;
+    auto one = empty.insert(1, "one");
+    auto two = one.insert(2, "two");
+    auto changed = two.insert(1, "uno");
+    EXPECT_EQ(empty.size(), 0u);
+    EXPECT_EQ(one.size(), 1u);
+    EXPECT_EQ(*one.find(1), "one");
+    EXPECT_EQ(*changed.find(1), "uno");
+    EXPECT_EQ(*two.find(1), "one");
+    EXPECT_EQ(changed.size(), 2u);
+    EXPECT_FALSE(one.contains(2));
+    EXPECT_TRUE(two.erase(5).same_version(two));
+    EXPECT_FALSE(two.erase(2).same_version(two));
+
+    // Every version kept along the way still matches a std::map
+    // snapshot taken at the same point.
+    std::mt19937 rng(8);
+    std::vector<PersistentBinaryTree<int, int>> versions(1);
+    std::vector<std::map<int, int>> expected(1);
+    for (int i = 0; i < 20000; ++i)
+    {
+        int k = rng() % 3000;
+        if (rng() % 3)
+        {
+            versions.push_back(versions.back().insert(k, i));
+            expected.push_back(expected.back());
+            expected.back()[k] = i;
+        }
+        else
+        {
+            versions.push_back(versions.back().erase(k));
+            expected.push_back(expected.back());
+            expected.back().erase(k);
+        }
+        if (i % 500 == 0)
+        {
+            // Drop some history; what is left must not notice.
+            versions.erase(versions.begin(), versions.begin() + versions.size() / 2);
+            expected.erase(expected.begin(), expected.begin() + expected.size() / 2);
+        }
+    }
+    for (size_t v = 0; v < versions.size(); v += 97)
+    {
+        std::vector<std::pair<const int, int>> seen;
+        versions[v].for_each([&](int k, int value) { seen.emplace_back(k, value); });
+        EXPECT_TRUE(std::ranges::equal(seen, expected[v]));
+        EXPECT_EQ(versions[v].size(), expected[v].size());
+        EXPECT_LE(versions[v].height(), 1.45 * std::log2(expected[v].size() + 2));
+    }
+}
@@ -0,0 +1,340 @@
+// Compares the C tree (hw2) and the C++ BinaryTree (hw4) against
+// std::map and std::unordered_map.
+//
+//   ./mapbench [max_n] [impl...]
+//
+// Sizes run from 1000 up to max_n (default 1000000) in steps of 10,
+// plus max_n itself.  impl is any of ctree, binarytree, map,
+// unordered_map (default: all).  Results go to standard output as a
+// JSON array with one object per implementation, key order, workload
+// and size.
+//
+// Each implementation/order/size runs in its own child process, so
+// peak_rss_kb is the peak resident memory of just that run.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tree.hpp"
+
+extern "C"
+{
+#include "tree.h"
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// The keys one run works with.  inserts is the insert order (with
+// repeats for zipf), hits are keys that are present in the order they
+// are looked up, misses are never present, and fresh are new keys for
+// the erase-heavy phase.  Present keys are even, absent ones odd.
+struct workload_keys {
+    std::vector<int64_t> inserts;
+    std::vector<int64_t> hits;
+    std::vector<int64_t> misses;
+    std::vector<int64_t> fresh;
+};
+
+static workload_keys make_keys(const std::string &order, size_t n)
+{
+    workload_keys w;
+    std::mt19937_64 rng(12345);
+    std::vector<int64_t> distinct(n);
+    for (size_t i = 0; i < n; ++i) {
+        distinct[i] = (int64_t) i * 4;
+    }
+    if (order == "sorted") {
+        w.inserts = distinct;
+    } else if (order == "reverse") {
+        w.inserts.assign(distinct.rbegin(), distinct.rend());
+    } else {
+        std::shuffle(distinct.begin(), distinct.end(), rng);
+        w.inserts = distinct;
+    }
+
+    if (order == "zipf") {
+        // Zipf(s = 1) over the shuffled keys: a few keys take most of
+        // the inserts and lookups.
+        std::vector<double> cdf(n);
+        double total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            total += 1.0 / (double) (i + 1);
+            cdf[i] = total;
+        }
+        std::uniform_real_distribution<double> u(0, total);
+        auto draw = [&]() {
+            return distinct[std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin()];
+        };
+        for (size_t i = 0; i < n; ++i) {
+            w.inserts[i] = draw();
+        }
+        // Lookups sample the insert stream itself, so every one hits and
+        // popular keys are still looked up as often as they were inserted.
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        for (size_t i = 0; i < n; ++i) {
+            w.hits.push_back(w.inserts[pick(rng)]);
+        }
+    } else {
+        w.hits = w.inserts;
+        std::shuffle(w.hits.begin(), w.hits.end(), rng);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        w.misses.push_back(w.hits[i] + 1);
+        w.fresh.push_back(w.hits[i] + 2);
+    }
+    return w;
+}
+
+// Each adapter provides insert/contains/erase/iterate/height over int64
+// keys so every implementation runs exactly the same loops.
+struct ctree_adapter {
+    tree *t = new_int64_tree();
+    // The C tree stores pointers to keys, so they need a stable home.
+    std::vector<int64_t> storage;
+    size_t used = 0;
+
+    explicit ctree_adapter(size_t capacity) : storage(capacity) {}
+    ~ctree_adapter() { free_tree(t); }
+
+    void insert(int64_t k)
+    {
+        storage[used] = k;
+        ::insert(t, &storage[used], &storage[used]);
+        used++;
+    }
+    bool contains(int64_t k) { return ::contains(t, &k); }
+    void erase(int64_t k) { tree_erase(t, &k); }
+    int64_t iterate()
+    {
+        int64_t sum = 0;
+        traverse(t, [](void *key, void *, void *context) {
+            *(int64_t *) context += *(int64_t *) key;
+        }, &sum);
+        return sum;
+    }
+    // Measured without recursion: an unbalanced tree can be very deep.
+    long height()
+    {
+        long levels = 0;
+        std::vector<tree_node *> level;
+        if (t->root != nullptr) {
+            level.push_back(t->root);
+        }
+        while (!level.empty()) {
+            std::vector<tree_node *> next;
+            for (tree_node *n : level) {
+                if (n->left) next.push_back(n->left);
+                if (n->right) next.push_back(n->right);
+            }
+            level.swap(next);
+            levels++;
+        }
+        return levels;
+    }
+};
+
+struct binarytree_adapter {
+    BinaryTree<int64_t, int64_t> b;
+
+    explicit binarytree_adapter(size_t) {}
+    void insert(int64_t k) { b[k] = k; }
+    bool contains(int64_t k) { return b.contains(k); }
+    void erase(int64_t k) { b.erase(k); }
+    int64_t iterate()
+    {
+        int64_t sum = 0;
+        for (const auto &[key, value] : b) {
+            sum += key;
+        }
+        return sum;
+    }
+    long height() { return b.height(); }
+};
+
+// Red-black tree height isn't exposed, so height is reported as -1.
+template <class Map>
+struct std_adapter {
+    Map m;
+
+    explicit std_adapter(size_t) {}
+    void insert(int64_t k) { m[k] = k; }
+    bool contains(int64_t k) { return m.find(k) != m.end(); }
+    void erase(int64_t k) { m.erase(k); }
+    int64_t iterate()
+    {
+        int64_t sum = 0;
+        for (const auto &[key, value] : m) {
+            sum += key;
+        }
+        return sum;
+    }
+    long height() { return -1; }
+};
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void emit(FILE *out, const char *impl, const std::string &order, const char *workload,
+                 size_t n, size_t ops, double seconds, long rss_kb, long height, int64_t check)
+{
+    fprintf(out,
+            "{\"impl\": \"%s\", \"order\": \"%s\", \"workload\": \"%s\", \"n\": %zu, "
+            "\"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, \"peak_rss_kb\": %ld, "
+            "\"height\": %ld, \"check\": %lld}\n",
+            impl, order.c_str(), workload, n, ops, seconds, ops / std::max(seconds, 1e-9), rss_kb,
+            height, (long long) check);
+}
+
+template <class Adapter>
+static void run(FILE *out, const char *impl, const std::string &order, size_t n)
+{
+    workload_keys w = make_keys(order, n);
+    long baseline_kb = peak_rss_kb();
+    Adapter a(n * 2);
+
+    auto start = bench_clock::now();
+    for (int64_t k : w.inserts) {
+        a.insert(k);
+    }
+    double seconds = seconds_since(start);
+    long rss = peak_rss_kb() - baseline_kb;
+    long height = a.height();
+    emit(out, impl, order, "insert", n, n, seconds, rss, height, 0);
+
+    int64_t found = 0;
+    start = bench_clock::now();
+    for (int64_t k : w.hits) {
+        found += a.contains(k);
+    }
+    emit(out, impl, order, "lookup_hit", n, n, seconds_since(start), rss, height, found);
+
+    found = 0;
+    start = bench_clock::now();
+    for (int64_t k : w.misses) {
+        found += a.contains(k);
+    }
+    emit(out, impl, order, "lookup_miss", n, n, seconds_since(start), rss, height, found);
+
+    start = bench_clock::now();
+    int64_t sum = a.iterate();
+    emit(out, impl, order, "iteration", n, n, seconds_since(start), rss, height, sum);
+
+    // Steady churn: every erase of a present key is paired with an
+    // insert of a new one, then a lookup.
+    start = bench_clock::now();
+    found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        a.erase(w.hits[i]);
+        a.insert(w.fresh[i]);
+        found += a.contains(w.hits[(i * 7) % n]);
+    }
+    seconds = seconds_since(start);
+    emit(out, impl, order, "erase_heavy", n, 3 * n, seconds, peak_rss_kb() - baseline_kb,
+         a.height(), found);
+}
+
+// Builds from sorted keys are quadratic in the unbalanced C tree, so
+// those runs stop at this size.
+static const size_t CTREE_SORTED_LIMIT = 20000;
+
+static bool run_one(FILE *out, const std::string &impl, const std::string &order, size_t n)
+{
+    if (impl == "ctree") {
+        if (order != "random" && order != "zipf" && n > CTREE_SORTED_LIMIT) {
+            return false;
+        }
+        run<ctree_adapter>(out, "ctree", order, n);
+    } else if (impl == "binarytree") {
+        run<binarytree_adapter>(out, "binarytree", order, n);
+    } else if (impl == "map") {
+        run<std_adapter<std::map<int64_t, int64_t>>>(out, "map", order, n);
+    } else if (impl == "unordered_map") {
+        run<std_adapter<std::unordered_map<int64_t, int64_t>>>(out, "unordered_map", order, n);
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    std::vector<std::string> impls;
+    for (int i = 2; i < argc; ++i) {
+        impls.push_back(argv[i]);
+    }
+    if (impls.empty()) {
+        impls = {"ctree", "binarytree", "map", "unordered_map"};
+    }
+    std::vector<size_t> sizes;
+    for (size_t n = 1000; n <= max_n; n *= 10) {
+        sizes.push_back(n);
+    }
+    if (sizes.empty() || sizes.back() != max_n) {
+        sizes.push_back(max_n);
+    }
+
+    bool first = true;
+    printf("[\n");
+    for (size_t n : sizes) {
+        for (const char *order : {"random", "sorted", "reverse", "zipf"}) {
+            for (auto &impl : impls) {
+                fflush(stdout);
+                int fds[2];
+                if (pipe(fds) != 0) {
+                    perror("pipe");
+                    return 1;
+                }
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(fds[0]);
+                    FILE *out = fdopen(fds[1], "w");
+                    if (!run_one(out, impl, order, n)) {
+                        fprintf(out, "{\"impl\": \"%s\", \"order\": \"%s\", \"n\": %zu, "
+                                "\"skipped\": \"quadratic build\"}\n", impl.c_str(), order, n);
+                    }
+                    fclose(out);
+                    _exit(0);
+                }
+                close(fds[1]);
+                FILE *in = fdopen(fds[0], "r");
+                char line[1024];
+                while (fgets(line, sizeof(line), in)) {
+                    line[strcspn(line, "\n")] = '\0';
+                    printf("%s  %s", first ? "" : ",\n", line);
+                    first = false;
+                }
+                fclose(in);
+                int status;
+                waitpid(pid, &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    fprintf(stderr, "%s/%s/%zu failed\n", impl.c_str(), order, n);
+                }
+            }
+        }
+    }
+    printf("\n]\n");
+    return 0;
+}